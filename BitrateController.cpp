@@ -0,0 +1,60 @@
+#include "BitrateController.h"
+
+#include <algorithm>
+
+
+namespace {
+
+const double LowLoss = 0.02;
+const double HighLoss = 0.1;
+const double IncreaseFactor = 1.05;
+const double DelayDecreaseFactor = 0.85;
+// queuing delay (seconds) above minimal round trip time treated as congestion
+const double QueuingDelayThreshold = 0.2;
+// lets minimal round trip time follow route changes
+const double MinRoundTripTimeDrift = 1.01;
+
+}
+
+BitrateController::BitrateController(unsigned minBitrate, unsigned maxBitrate) noexcept :
+    _minBitrate(std::min(minBitrate, maxBitrate)),
+    _maxBitrate(maxBitrate),
+    // start from the middle to not flood constrained uplink
+    _bitrate(std::max(_minBitrate, maxBitrate / 2))
+{
+}
+
+unsigned BitrateController::bitrate() const noexcept
+{
+    return _bitrate;
+}
+
+bool BitrateController::update(double fractionLost, double roundTripTime) noexcept
+{
+    bool congested = false;
+    if(roundTripTime > 0) {
+        if(_minRoundTripTime < 0)
+            _minRoundTripTime = roundTripTime;
+        else
+            _minRoundTripTime = std::min(roundTripTime, _minRoundTripTime * MinRoundTripTimeDrift);
+
+        congested = roundTripTime > _minRoundTripTime + QueuingDelayThreshold;
+    }
+
+    double bitrate = _bitrate;
+    if(fractionLost > HighLoss)
+        bitrate *= 1 - 0.5 * fractionLost;
+    else if(congested)
+        bitrate *= DelayDecreaseFactor;
+    else if(fractionLost < LowLoss)
+        bitrate = bitrate * IncreaseFactor + 1;
+
+    const unsigned newBitrate =
+        std::max(_minBitrate, std::min(_maxBitrate, static_cast<unsigned>(bitrate)));
+    if(newBitrate == _bitrate)
+        return false;
+
+    _bitrate = newBitrate;
+
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+
+// Loss and queuing delay based target bitrate estimation
+// (close to loss based part of Google Congestion Control).
+class BitrateController
+{
+public:
+    // kbit/s
+    BitrateController(unsigned minBitrate, unsigned maxBitrate) noexcept;
+
+    unsigned bitrate() const noexcept;
+
+    // roundTripTime is in seconds, < 0 if unknown.
+    // returns true if bitrate was changed
+    bool update(double fractionLost, double roundTripTime) noexcept;
+
+private:
+    const unsigned _minBitrate;
+    const unsigned _maxBitrate;
+
+    unsigned _bitrate;
+    double _minRoundTripTime = -1;
+};
@@ -0,0 +1,347 @@
+#include "CpuGovernor.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+
+#include "CxxPtr/GstPtr.h"
+
+#include "Log.h"
+
+
+namespace {
+
+enum {
+    TICK_INTERVAL = 1000, // ms
+    // ticks to let pipeline settle after level change
+    HOLD_TICKS = 3,
+    // ticks of continuous headroom required to step up
+    HEADROOM_TICKS = 10,
+    // vp8enc/vp9enc "cpu-used" for FAST_ENCODER level
+    FAST_CPU_USED = 16,
+};
+
+const auto Log = ClientLog;
+
+struct Entry
+{
+    GstElementPtr binPtr;
+    int priority;
+    unsigned level;
+};
+
+std::mutex RegistryMutex;
+std::map<unsigned, Entry> Registry;
+unsigned NextId = 1;
+
+// unlike gst_bin_get_by_name() doesn't look into child bins
+GstElementPtr FindChild(GstElement* bin, const gchar* name)
+{
+    GstIterator* iterator = gst_bin_iterate_elements(GST_BIN(bin));
+
+    GValue item = G_VALUE_INIT;
+    const gboolean found =
+        gst_iterator_find_custom(
+            iterator,
+            [] (gconstpointer value, gconstpointer name) -> gint {
+                GstElement* element =
+                    GST_ELEMENT(g_value_get_object(static_cast<const GValue*>(value)));
+                return g_strcmp0(GST_OBJECT_NAME(element), static_cast<const gchar*>(name));
+            },
+            &item,
+            const_cast<gchar*>(name));
+    gst_iterator_free(iterator);
+
+    GstElementPtr elementPtr;
+    if(found) {
+        elementPtr.reset(GST_ELEMENT(g_value_dup_object(&item)));
+        g_value_unset(&item);
+    }
+
+    return elementPtr;
+}
+
+bool HasProperty(GstElement* element, const gchar* name)
+{
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != nullptr;
+}
+
+// encoder can't keep up with it's input
+bool IsBacklogged(GstElement* bin)
+{
+    GstElementPtr queuePtr = FindChild(bin, "encoder-queue");
+    if(!queuePtr)
+        return false;
+
+    guint level = 0;
+    guint maxLevel = 0;
+    g_object_get(
+        queuePtr.get(),
+        "current-level-buffers", &level,
+        "max-size-buffers", &maxLevel,
+        nullptr);
+
+    return maxLevel > 0 && level * 2 >= maxLevel;
+}
+
+void ApplyLevel(GstElement* bin, unsigned level)
+{
+    GstElementPtr encoderPtr = FindChild(bin, "encoder");
+    if(encoderPtr && HasProperty(encoderPtr.get(), "cpu-used")) {
+        g_object_set(
+            encoderPtr.get(),
+            "cpu-used", level >= CpuGovernor::FAST_ENCODER ? FAST_CPU_USED : 0,
+            nullptr);
+    }
+    // x264enc is configured with the fastest preset already
+
+    GstElementPtr ratePtr = FindChild(bin, "ladder-rate");
+    if(!ratePtr)
+        return;
+
+    GstPadPtr rateSinkPadPtr(gst_element_get_static_pad(ratePtr.get(), "sink"));
+    GstCapsPtr capsPtr(gst_pad_get_current_caps(rateSinkPadPtr.get()));
+    const GstStructure* structure =
+        capsPtr && !gst_caps_is_empty(capsPtr.get()) ?
+            gst_caps_get_structure(capsPtr.get(), 0) :
+            nullptr;
+
+    gint maxRate = G_MAXINT;
+    gint framerateNum = 0;
+    gint framerateDen = 1;
+    if(level >= CpuGovernor::HALF_FRAMERATE && structure &&
+       gst_structure_get_fraction(structure, "framerate", &framerateNum, &framerateDen) &&
+       framerateNum > 0 && framerateDen > 0)
+    {
+        maxRate = std::max(1, framerateNum / framerateDen / 2);
+    }
+    g_object_set(ratePtr.get(), "max-rate", maxRate, nullptr);
+
+    GstElementPtr capsFilterPtr = FindChild(bin, "ladder-caps");
+    if(!capsFilterPtr)
+        return;
+
+    gint width = 0;
+    gint height = 0;
+    GstCapsPtr ladderCapsPtr(gst_caps_new_empty_simple("video/x-raw"));
+    if(level >= CpuGovernor::HALF_RESOLUTION && structure &&
+       gst_structure_get_int(structure, "width", &width) &&
+       gst_structure_get_int(structure, "height", &height))
+    {
+        // most encoders require even dimensions
+        gst_caps_set_simple(
+            ladderCapsPtr.get(),
+            "width", G_TYPE_INT, std::max(2, (width / 2) & ~1),
+            "height", G_TYPE_INT, std::max(2, (height / 2) & ~1),
+            nullptr);
+    }
+    g_object_set(capsFilterPtr.get(), "caps", ladderCapsPtr.get(), nullptr);
+}
+
+}
+
+// encoder queue is limited by frames count only,
+// otherwise default time/bytes limits are reached long before
+// backlog threshold (half of max-size-buffers) and backlog is never noticed
+const char* const CpuGovernor::Ladder =
+    "videorate name=ladder-rate drop-only=true"
+    " ! videoscale ! capsfilter name=ladder-caps"
+    " ! queue name=encoder-queue max-size-buffers=10 max-size-time=0 max-size-bytes=0 ! ";
+
+CpuGovernor::Client::Client() noexcept
+{
+}
+
+CpuGovernor::Client::~Client()
+{
+    detach();
+}
+
+void CpuGovernor::Client::attach(GstElement* bin, int priority) noexcept
+{
+    detach();
+
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+
+    _id = NextId++;
+    Registry.emplace(
+        _id,
+        Entry {
+            GstElementPtr(GST_ELEMENT(gst_object_ref(bin))),
+            priority,
+            FULL_QUALITY });
+}
+
+void CpuGovernor::Client::detach() noexcept
+{
+    if(!_id)
+        return;
+
+    GstElementPtr binPtr;
+    {
+        std::lock_guard<std::mutex> lock(RegistryMutex);
+
+        auto it = Registry.find(_id);
+        if(it != Registry.end()) {
+            // could be the last reference, so released outside of lock
+            binPtr = std::move(it->second.binPtr);
+            Registry.erase(it);
+        }
+    }
+
+    _id = 0;
+}
+
+CpuGovernor::CpuGovernor(const CpuGovernorConfig& config) noexcept :
+    _config(config)
+{
+    unsigned load;
+    sampleLoad(&load);
+
+    _tickSourcePtr.reset(g_timeout_source_new(TICK_INTERVAL));
+    g_source_set_callback(
+        _tickSourcePtr.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<CpuGovernor*>(userData)->onTick();
+            return G_SOURCE_CONTINUE;
+        }, this, nullptr);
+    g_source_attach(_tickSourcePtr.get(), g_main_context_get_thread_default());
+}
+
+CpuGovernor::~CpuGovernor()
+{
+    g_source_destroy(_tickSourcePtr.get());
+}
+
+// host CPU load (%) since previous sample
+bool CpuGovernor::sampleLoad(unsigned* load) noexcept
+{
+    gchar* contents = nullptr;
+    if(!g_file_get_contents("/proc/stat", &contents, nullptr, nullptr))
+        return false;
+
+    guint64 user = 0, nice = 0, system = 0, idle = 0;
+    guint64 iowait = 0, irq = 0, softirq = 0, steal = 0;
+    const int fields =
+        sscanf(
+            contents,
+            "cpu %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+            " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+            " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+            &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
+    g_free(contents);
+
+    if(fields < 4)
+        return false;
+
+    const guint64 busy = user + nice + system + irq + softirq + steal;
+    const guint64 total = busy + idle + iowait;
+
+    const bool hasPrevious = _lastTotal != 0 && total > _lastTotal;
+    if(hasPrevious)
+        *load = static_cast<unsigned>((busy - _lastBusy) * 100 / (total - _lastTotal));
+
+    _lastBusy = busy;
+    _lastTotal = total;
+
+    return hasPrevious;
+}
+
+void CpuGovernor::onTick() noexcept
+{
+    unsigned load = 0;
+    const bool loadKnown = sampleLoad(&load);
+
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+
+    if(Registry.empty()) {
+        _holdTicks = 0;
+        _headroomTicks = 0;
+        return;
+    }
+
+    // the lowest priority backlogged encoder able to step down
+    std::pair<const unsigned, Entry>* backlogged = nullptr;
+    bool anyBacklogged = false;
+    for(auto& pair: Registry) {
+        if(!IsBacklogged(pair.second.binPtr.get()))
+            continue;
+
+        anyBacklogged = true;
+        if(pair.second.level < MAX_LEVEL &&
+           (!backlogged || pair.second.priority < backlogged->second.priority))
+        {
+            backlogged = &pair;
+        }
+    }
+
+    const bool overloaded = (loadKnown && load >= _config.highLoad) || anyBacklogged;
+    const bool headroom = loadKnown && load <= _config.lowLoad && !anyBacklogged;
+
+    _headroomTicks = headroom ? _headroomTicks + 1 : 0;
+
+    if(_holdTicks > 0) {
+        --_holdTicks;
+        return;
+    }
+
+    std::pair<const unsigned, Entry>* target = nullptr;
+    unsigned level = 0;
+    if(overloaded) {
+        target = backlogged;
+        if(!target) {
+            // degrade few streams deeply instead of all streams a bit
+            for(auto& pair: Registry) {
+                const Entry& entry = pair.second;
+                if(entry.level >= MAX_LEVEL)
+                    continue;
+
+                if(!target ||
+                   entry.priority < target->second.priority ||
+                   (entry.priority == target->second.priority &&
+                    entry.level > target->second.level))
+                {
+                    target = &pair;
+                }
+            }
+        }
+        if(target)
+            level = target->second.level + 1;
+    } else if(_headroomTicks >= HEADROOM_TICKS) {
+        for(auto& pair: Registry) {
+            const Entry& entry = pair.second;
+            if(entry.level == FULL_QUALITY)
+                continue;
+
+            if(!target ||
+               entry.priority > target->second.priority ||
+               (entry.priority == target->second.priority &&
+                entry.level < target->second.level))
+            {
+                target = &pair;
+            }
+        }
+        if(target)
+            level = target->second.level - 1;
+    }
+
+    if(!target)
+        return;
+
+    Log()->info(
+        "Encoder #{} (priority {}): degradation level {} -> {}. CPU load: {}%{}",
+        target->first,
+        target->second.priority,
+        target->second.level,
+        level,
+        loadKnown ? std::to_string(load) : "?",
+        anyBacklogged ? ", encoder backlog" : "");
+
+    ApplyLevel(target->second.binPtr.get(), level);
+    target->second.level = level;
+
+    _holdTicks = HOLD_TICKS;
+    _headroomTicks = 0;
+}
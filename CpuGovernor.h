@@ -0,0 +1,72 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include "CxxPtr/GlibPtr.h"
+
+
+struct CpuGovernorConfig
+{
+    bool enabled = false;
+    unsigned highLoad = 90; // %, host CPU load to step encoders down
+    unsigned lowLoad = 60; // %, host CPU load to step encoders back up
+};
+
+// Process wide governor stepping encoders down the degradation ladder
+// while host CPU (or encoder itself) is overloaded
+// and back up when headroom returns.
+// Lower priority encoders are degraded first (and restored last).
+class CpuGovernor
+{
+public:
+    enum Level {
+        FULL_QUALITY = 0,
+        FAST_ENCODER = 1,
+        HALF_FRAMERATE = 2,
+        HALF_RESOLUTION = 3,
+        MAX_LEVEL = HALF_RESOLUTION,
+    };
+
+    // fragment to insert in front of encoder,
+    // so bin becomes manageable by governor
+    static const char* const Ladder;
+
+    // registration of encoding bin with "Ladder" fragment and element named "encoder"
+    class Client
+    {
+    public:
+        Client() noexcept;
+        ~Client();
+
+        Client(const Client&) = delete;
+        Client& operator = (const Client&) = delete;
+
+        void attach(GstElement* bin, int priority) noexcept;
+        void detach() noexcept;
+
+    private:
+        unsigned _id = 0;
+    };
+
+    // should be created on thread running main loop
+    explicit CpuGovernor(const CpuGovernorConfig&) noexcept;
+    ~CpuGovernor();
+
+    CpuGovernor(const CpuGovernor&) = delete;
+    CpuGovernor& operator = (const CpuGovernor&) = delete;
+
+private:
+    bool sampleLoad(unsigned* load) noexcept;
+    void onTick() noexcept;
+
+private:
+    const CpuGovernorConfig _config;
+
+    GSourcePtr _tickSourcePtr;
+
+    guint64 _lastBusy = 0;
+    guint64 _lastTotal = 0;
+
+    unsigned _holdTicks = 0;
+    unsigned _headroomTicks = 0;
+};
@@ -0,0 +1,237 @@
+#include "GopCache.h"
+
+
+namespace {
+
+enum {
+    MAX_PACKETS = 4096,
+    MAX_SIZE = 8 * 1024 * 1024,
+};
+
+bool ParseRtp(
+    const guint8* data, gsize size,
+    const guint8** payload, gsize* payloadSize,
+    bool* marker)
+{
+    if(size < 12 || (data[0] >> 6) != 2)
+        return false;
+
+    const bool padding = data[0] & 0x20;
+    const bool extension = data[0] & 0x10;
+    const unsigned csrcCount = data[0] & 0x0F;
+
+    *marker = data[1] & 0x80;
+
+    gsize offset = 12 + csrcCount * 4;
+    if(extension) {
+        if(size < offset + 4)
+            return false;
+
+        offset += 4 + ((data[offset + 2] << 8) | data[offset + 3]) * 4;
+    }
+
+    gsize end = size;
+    if(padding)
+        end -= data[size - 1];
+
+    if(offset >= end || end > size)
+        return false;
+
+    *payload = data + offset;
+    *payloadSize = end - offset;
+
+    return true;
+}
+
+inline bool IsH264KeyNal(guint8 nalType)
+{
+    return nalType == 5 /* IDR */ || nalType == 7 /* SPS */;
+}
+
+bool IsH264Keyframe(const guint8* payload, gsize size)
+{
+    const guint8 nalType = payload[0] & 0x1F;
+    switch(nalType) {
+    case 24: { // STAP-A
+        gsize offset = 1;
+        while(offset + 2 < size) {
+            const gsize nalSize = (payload[offset] << 8) | payload[offset + 1];
+            offset += 2;
+            if(nalSize == 0 || offset + nalSize > size)
+                break;
+
+            if(IsH264KeyNal(payload[offset] & 0x1F))
+                return true;
+
+            offset += nalSize;
+        }
+        return false;
+    }
+    case 28: // FU-A
+        return size >= 2 &&
+            (payload[1] & 0x80) /* start */ &&
+            IsH264KeyNal(payload[1] & 0x1F);
+    default:
+        return IsH264KeyNal(nalType);
+    }
+}
+
+bool IsVp8Keyframe(const guint8* payload, gsize size)
+{
+    const bool extended = payload[0] & 0x80;
+    const bool start = payload[0] & 0x10;
+    const guint8 partitionId = payload[0] & 0x07;
+    if(!start || partitionId != 0)
+        return false;
+
+    gsize offset = 1;
+    if(extended) {
+        if(size < 2)
+            return false;
+
+        const guint8 extensions = payload[1];
+        offset = 2;
+        if(extensions & 0x80) { // PictureID
+            if(size <= offset)
+                return false;
+            offset += (payload[offset] & 0x80) ? 2 : 1;
+        }
+        if(extensions & 0x40) // TL0PICIDX
+            offset += 1;
+        if(extensions & 0x30) // TID/KEYIDX
+            offset += 1;
+    }
+
+    if(offset >= size)
+        return false;
+
+    // inverse key frame flag of VP8 payload header
+    return (payload[offset] & 0x01) == 0;
+}
+
+}
+
+GopCache::GopCache() noexcept
+{
+}
+
+GopCache::~GopCache()
+{
+    reset();
+}
+
+void GopCache::reset() noexcept
+{
+    for(GstBuffer* packet: _packets)
+        gst_buffer_unref(packet);
+
+    _packets.clear();
+    _size = 0;
+}
+
+void GopCache::clear() noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    reset();
+    _previousMarker = true;
+}
+
+void GopCache::setCaps(const GstCaps* caps) noexcept
+{
+    Codec codec = Codec::Unknown;
+    if(caps && !gst_caps_is_empty(caps)) {
+        const GstStructure* structure = gst_caps_get_structure(caps, 0);
+        const gchar* encoding = gst_structure_get_string(structure, "encoding-name");
+        if(encoding && 0 == g_ascii_strcasecmp(encoding, "H264"))
+            codec = Codec::H264;
+        else if(encoding && 0 == g_ascii_strcasecmp(encoding, "VP8"))
+            codec = Codec::VP8;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(codec != _codec) {
+        reset();
+        _codec = codec;
+    }
+}
+
+bool GopCache::isKeyframeStart(GstBuffer* buffer, bool* marker) const noexcept
+{
+    GstMapInfo map;
+    if(!gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return false;
+
+    const guint8* payload;
+    gsize payloadSize;
+    bool keyframe = false;
+    *marker = false;
+    if(ParseRtp(map.data, map.size, &payload, &payloadSize, marker)) {
+        switch(_codec) {
+        case Codec::H264:
+            // SPS/PPS are sent in front of IDR, so only first packet of access unit counts
+            keyframe = _previousMarker && IsH264Keyframe(payload, payloadSize);
+            break;
+        case Codec::VP8:
+            keyframe = IsVp8Keyframe(payload, payloadSize);
+            break;
+        default:
+            break;
+        }
+    }
+
+    gst_buffer_unmap(buffer, &map);
+
+    return keyframe;
+}
+
+void GopCache::push(GstBuffer* buffer) noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_codec == Codec::Unknown)
+        return;
+
+    bool marker;
+    if(isKeyframeStart(buffer, &marker))
+        reset();
+    else if(_packets.empty()) {
+        // waiting for keyframe
+        _previousMarker = marker;
+        return;
+    }
+
+    _previousMarker = marker;
+
+    const gsize size = gst_buffer_get_size(buffer);
+    if(_packets.size() >= MAX_PACKETS || _size + size > MAX_SIZE) {
+        // GOP is too long to be cached
+        reset();
+        return;
+    }
+
+    _packets.push_back(gst_buffer_ref(buffer));
+    _size += size;
+}
+
+bool GopCache::empty() noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _packets.empty();
+}
+
+GstBufferList* GopCache::gop() noexcept
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_packets.empty())
+        return nullptr;
+
+    GstBufferList* list = gst_buffer_list_new_sized(_packets.size());
+    for(GstBuffer* packet: _packets)
+        gst_buffer_list_add(list, gst_buffer_ref(packet));
+
+    return list;
+}
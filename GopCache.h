@@ -0,0 +1,48 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <gst/gst.h>
+
+
+// Keeps RTP packets of the most recent GOP (starting from keyframe),
+// so new peer can get picture immediately instead of waiting for next keyframe.
+// Supports H264 and VP8 payloads.
+class GopCache
+{
+public:
+    GopCache() noexcept;
+    ~GopCache();
+
+    GopCache(const GopCache&) = delete;
+    GopCache& operator = (const GopCache&) = delete;
+
+    void setCaps(const GstCaps*) noexcept;
+    void push(GstBuffer*) noexcept;
+    void clear() noexcept;
+
+    bool empty() noexcept;
+
+    // new reference to cached packets, nullptr if there is no complete GOP start
+    GstBufferList* gop() noexcept;
+
+private:
+    enum class Codec {
+        Unknown,
+        H264,
+        VP8,
+    };
+
+    bool isKeyframeStart(GstBuffer*, bool* marker) const noexcept;
+    void reset() noexcept;
+
+private:
+    std::mutex _mutex;
+
+    Codec _codec = Codec::Unknown;
+    bool _previousMarker = true;
+
+    std::vector<GstBuffer*> _packets;
+    gsize _size = 0;
+};
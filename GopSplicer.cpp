@@ -0,0 +1,213 @@
+#include "GopSplicer.h"
+
+
+namespace {
+
+enum {
+    // whole GOP is resent on every splice, so it's not allowed too often
+    MIN_SPLICE_INTERVAL = G_USEC_PER_SEC,
+};
+
+bool ReadRtp(GstBuffer* buffer, guint16* seq, guint32* ts)
+{
+    guint8 header[8];
+    if(gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header) ||
+       (header[0] >> 6) != 2)
+    {
+        return false;
+    }
+
+    *seq = GST_READ_UINT16_BE(header + 2);
+    *ts = GST_READ_UINT32_BE(header + 4);
+
+    return true;
+}
+
+// buffer should be writable
+void WriteRtp(GstBuffer* buffer, guint16 seq, guint32 ts)
+{
+    guint8 fields[6];
+    GST_WRITE_UINT16_BE(fields, seq);
+    GST_WRITE_UINT32_BE(fields + 2, ts);
+
+    gst_buffer_fill(buffer, 2, fields, sizeof(fields));
+}
+
+inline bool IsBefore(guint32 ts, guint32 otherTs)
+{
+    return static_cast<gint32>(ts - otherTs) < 0;
+}
+
+}
+
+GopSplicer::GopSplicer(const std::shared_ptr<GopCache>& cachePtr) noexcept :
+    _cachePtr(cachePtr), _spliceRequested(false)
+{
+}
+
+void GopSplicer::requestSplice() noexcept
+{
+    _spliceRequested = true;
+}
+
+bool GopSplicer::canSplice() noexcept
+{
+    return !_cachePtr->empty();
+}
+
+GstBufferList* GopSplicer::splice() noexcept
+{
+    if(!_spliceRequested.exchange(false))
+        return nullptr;
+
+    const gint64 now = g_get_monotonic_time();
+    if(_lastSpliceTime != 0 && now - _lastSpliceTime < MIN_SPLICE_INTERVAL)
+        return nullptr;
+
+    GstBufferList* gop = _cachePtr->gop();
+    if(!gop)
+        return nullptr;
+
+    const guint length = gst_buffer_list_length(gop);
+
+    guint16 firstSeq = 0, lastSeq = 0;
+    guint32 firstTs = 0, lastTs = 0;
+    guint32 frames = 0;
+    for(guint i = 0; i < length; ++i) {
+        guint16 seq;
+        guint32 ts;
+        if(!ReadRtp(gst_buffer_list_get(gop, i), &seq, &ts)) {
+            gst_buffer_list_unref(gop);
+            return nullptr;
+        }
+
+        if(i == 0) {
+            firstSeq = seq;
+            firstTs = ts;
+        }
+        if(i == 0 || ts != lastTs)
+            ++frames;
+
+        lastSeq = seq;
+        lastTs = ts;
+    }
+
+    if(!_started) {
+        _lastSeq = firstSeq - 1;
+        _lastTs = firstTs - 1;
+    }
+
+    // last GOP frame is placed where live stream would put it,
+    // but all GOP frames should fit after last sent packet (one tick apart),
+    // so GOP is rendered at once instead of adding latency
+    guint32 lastFrameTs = lastTs + _tsOffset;
+    if(IsBefore(lastFrameTs, _lastTs + frames))
+        lastFrameTs = _lastTs + frames;
+
+    gop = gst_buffer_list_make_writable(gop);
+
+    guint32 frame = 0;
+    guint32 previousTs = firstTs;
+    for(guint i = 0; i < length; ++i) {
+        GstBuffer* packet = gst_buffer_list_get_writable(gop, i);
+
+        guint16 seq;
+        guint32 ts;
+        ReadRtp(packet, &seq, &ts);
+        if(ts != previousTs) {
+            ++frame;
+            previousTs = ts;
+        }
+
+        WriteRtp(packet, static_cast<guint16>(_lastSeq + 1 + i), lastFrameTs - (frames - 1 - frame));
+    }
+
+    _seqOffset = static_cast<guint16>(_lastSeq + length - lastSeq);
+    _tsOffset = lastFrameTs - lastTs;
+
+    _lastSeq += length;
+    _lastTs = lastFrameTs;
+    _started = true;
+
+    _skipping = true;
+    _skipUntilSeq = lastSeq;
+
+    _lastSpliceTime = now;
+
+    return gop;
+}
+
+bool GopSplicer::map(guint16* seq, guint32* ts) noexcept
+{
+    if(_skipping) {
+        if(static_cast<gint16>(*seq - _skipUntilSeq) <= 0)
+            return false;
+
+        _skipping = false;
+    }
+
+    *seq += _seqOffset;
+    *ts += _tsOffset;
+
+    _lastSeq = *seq;
+    _lastTs = *ts;
+    _started = true;
+
+    return true;
+}
+
+bool GopSplicer::rewrite(GstBuffer** buffer) noexcept
+{
+    guint16 seq;
+    guint32 ts;
+    if(!ReadRtp(*buffer, &seq, &ts))
+        return true;
+
+    if(!map(&seq, &ts))
+        return false;
+
+    if(_seqOffset != 0 || _tsOffset != 0) {
+        *buffer = gst_buffer_make_writable(*buffer);
+        WriteRtp(*buffer, seq, ts);
+    }
+
+    return true;
+}
+
+bool GopSplicer::rewrite(GstBufferList** list) noexcept
+{
+    const guint length = gst_buffer_list_length(*list);
+    if(length == 0)
+        return false;
+
+    guint16 seq;
+    guint32 ts;
+
+    if(!_skipping && _seqOffset == 0 && _tsOffset == 0) {
+        // nothing to rewrite, only position is tracked
+        if(ReadRtp(gst_buffer_list_get(*list, length - 1), &seq, &ts))
+            map(&seq, &ts);
+
+        return true;
+    }
+
+    *list = gst_buffer_list_make_writable(*list);
+    for(guint i = 0; i < gst_buffer_list_length(*list);) {
+        if(!ReadRtp(gst_buffer_list_get(*list, i), &seq, &ts)) {
+            ++i;
+            continue;
+        }
+
+        if(!map(&seq, &ts)) {
+            gst_buffer_list_remove(*list, i, 1);
+            continue;
+        }
+
+        if(_seqOffset != 0 || _tsOffset != 0)
+            WriteRtp(gst_buffer_list_get_writable(*list, i), seq, ts);
+
+        ++i;
+    }
+
+    return gst_buffer_list_length(*list) > 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <gst/gst.h>
+
+#include "GopCache.h"
+
+
+// Splices cached GOP into RTP stream of single peer (on start and on keyframe request).
+// Sequence numbers and timestamps are rewritten,
+// so peer sees continuous stream with GOP frames right after already sent ones.
+// Should be used from single streaming thread (except requestSplice/canSplice).
+class GopSplicer
+{
+public:
+    explicit GopSplicer(const std::shared_ptr<GopCache>&) noexcept;
+
+    GopSplicer(const GopSplicer&) = delete;
+    GopSplicer& operator = (const GopSplicer&) = delete;
+
+    void requestSplice() noexcept;
+    bool canSplice() noexcept;
+
+    // cached GOP rewritten to follow already sent packets,
+    // nullptr if splice is not requested or is not possible right now
+    GstBufferList* splice() noexcept;
+
+    // returns false if live packet was already sent as part of GOP
+    bool rewrite(GstBuffer**) noexcept;
+    // returns false if nothing is left in list
+    bool rewrite(GstBufferList**) noexcept;
+
+private:
+    bool map(guint16* seq, guint32* ts) noexcept;
+
+private:
+    const std::shared_ptr<GopCache> _cachePtr;
+
+    std::atomic<bool> _spliceRequested;
+    gint64 _lastSpliceTime = 0;
+
+    bool _started = false;
+    // of last sent packet
+    guint16 _lastSeq = 0;
+    guint32 _lastTs = 0;
+
+    // applied to live packets after splice
+    guint16 _seqOffset = 0;
+    guint32 _tsOffset = 0;
+
+    // live packets up to this one were sent as part of GOP
+    bool _skipping = false;
+    guint16 _skipUntilSeq = 0;
+};
@@ -0,0 +1,34 @@
+#include "HandshakeLimit.h"
+
+#include <atomic>
+
+
+namespace {
+
+std::atomic<unsigned> HandshakesLimit(0);
+std::atomic<unsigned> HandshakesInProgress(0);
+
+}
+
+void SetHandshakesLimit(unsigned limit) noexcept
+{
+    HandshakesLimit = limit;
+}
+
+bool TryAcquireHandshake() noexcept
+{
+    const unsigned limit = HandshakesLimit;
+
+    unsigned inProgress = HandshakesInProgress;
+    do {
+        if(limit != 0 && inProgress >= limit)
+            return false;
+    } while(!HandshakesInProgress.compare_exchange_weak(inProgress, inProgress + 1));
+
+    return true;
+}
+
+void ReleaseHandshake() noexcept
+{
+    --HandshakesInProgress;
+}
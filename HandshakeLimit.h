@@ -0,0 +1,11 @@
+#pragma once
+
+
+// Process wide limit of Janus handshakes (create/attach/join/configure)
+// being in progress at the same time.
+
+// 0 - unlimited
+void SetHandshakesLimit(unsigned) noexcept;
+
+bool TryAcquireHandshake() noexcept;
+void ReleaseHandshake() noexcept;
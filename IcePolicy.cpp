@@ -0,0 +1,227 @@
+#include "IcePolicy.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ClientLog;
+
+struct Candidate
+{
+    std::string address;
+    std::string type;
+    std::string relatedAddress;
+};
+
+// "candidate:foundation component transport priority address port typ type [raddr address rport port] ..."
+bool ParseCandidate(const std::string& candidate, Candidate* parsed)
+{
+    std::vector<std::string> tokens;
+
+    std::string::size_type begin = candidate.find("candidate:");
+    if(begin == std::string::npos)
+        return false;
+    begin += strlen("candidate:");
+
+    while(begin < candidate.size()) {
+        const std::string::size_type end = candidate.find(' ', begin);
+        if(end == std::string::npos) {
+            tokens.push_back(candidate.substr(begin));
+            break;
+        }
+        if(end > begin)
+            tokens.push_back(candidate.substr(begin, end - begin));
+        begin = end + 1;
+    }
+
+    if(tokens.size() < 8 || tokens[6] != "typ")
+        return false;
+
+    parsed->address = tokens[4];
+    parsed->type = tokens[7];
+
+    for(unsigned i = 8; i + 1 < tokens.size(); i += 2) {
+        if(tokens[i] == "raddr")
+            parsed->relatedAddress = tokens[i + 1];
+    }
+
+    return true;
+}
+
+}
+
+IcePolicy::IcePolicy(const IceConfig& config) noexcept :
+    _transportPolicy(config.transportPolicy),
+    _filterAllowedInterfaces(!config.allowedInterfaces.empty())
+{
+    for(const std::string& address: config.allowedAddresses) {
+        Subnet subnet;
+        if(ParseSubnet(address, &subnet))
+            _allowedAddresses.push_back(subnet);
+        else
+            Log()->warn("Invalid ICE address filter \"{}\" ignored", address);
+    }
+
+    for(const std::string& address: config.deniedAddresses) {
+        Subnet subnet;
+        if(ParseSubnet(address, &subnet))
+            _deniedAddresses.push_back(subnet);
+        else
+            Log()->warn("Invalid ICE address filter \"{}\" ignored", address);
+    }
+
+    if(!config.allowedInterfaces.empty() || !config.deniedInterfaces.empty())
+        resolveInterfaces(config);
+}
+
+void IcePolicy::resolveInterfaces(const IceConfig& config) noexcept
+{
+    struct ifaddrs* interfaces = nullptr;
+    if(getifaddrs(&interfaces) != 0) {
+        Log()->error("Fail get network interfaces list. ICE interface filters ignored");
+        return;
+    }
+
+    for(struct ifaddrs* interface = interfaces; interface; interface = interface->ifa_next) {
+        if(!interface->ifa_addr || !interface->ifa_name)
+            continue;
+
+        Subnet address;
+        address.family = interface->ifa_addr->sa_family;
+        if(address.family == AF_INET) {
+            const sockaddr_in* addr = reinterpret_cast<const sockaddr_in*>(interface->ifa_addr);
+            memcpy(address.address, &addr->sin_addr, 4);
+            address.prefix = 32;
+        } else if(address.family == AF_INET6) {
+            const sockaddr_in6* addr = reinterpret_cast<const sockaddr_in6*>(interface->ifa_addr);
+            memcpy(address.address, &addr->sin6_addr, 16);
+            address.prefix = 128;
+        } else
+            continue;
+
+        const std::string name = interface->ifa_name;
+        const auto& allowed = config.allowedInterfaces;
+        const auto& denied = config.deniedInterfaces;
+        if(std::find(allowed.begin(), allowed.end(), name) != allowed.end())
+            _allowedInterfaceAddresses.push_back(address);
+        if(std::find(denied.begin(), denied.end(), name) != denied.end())
+            _deniedInterfaceAddresses.push_back(address);
+    }
+
+    freeifaddrs(interfaces);
+}
+
+bool IcePolicy::ParseSubnet(const std::string& value, Subnet* subnet) noexcept
+{
+    const std::string::size_type slash = value.find('/');
+    const std::string address = value.substr(0, slash);
+
+    if(1 == inet_pton(AF_INET, address.c_str(), subnet->address)) {
+        subnet->family = AF_INET;
+        subnet->prefix = 32;
+    } else if(1 == inet_pton(AF_INET6, address.c_str(), subnet->address)) {
+        subnet->family = AF_INET6;
+        subnet->prefix = 128;
+    } else
+        return false;
+
+    if(slash != std::string::npos) {
+        gchar* end = nullptr;
+        const guint64 prefix = g_ascii_strtoull(value.c_str() + slash + 1, &end, 10);
+        if(!end || *end != '\0' || end == value.c_str() + slash + 1 || prefix > subnet->prefix)
+            return false;
+
+        subnet->prefix = static_cast<unsigned>(prefix);
+    }
+
+    return true;
+}
+
+bool IcePolicy::Contains(const Subnet& subnet, const Subnet& address) noexcept
+{
+    if(subnet.family != address.family)
+        return false;
+
+    const unsigned fullBytes = subnet.prefix / 8;
+    if(0 != memcmp(subnet.address, address.address, fullBytes))
+        return false;
+
+    const unsigned restBits = subnet.prefix % 8;
+    if(restBits == 0)
+        return true;
+
+    const guint8 mask = static_cast<guint8>(0xFF << (8 - restBits));
+    return (subnet.address[fullBytes] & mask) == (address.address[fullBytes] & mask);
+}
+
+bool IcePolicy::ContainsAny(const std::vector<Subnet>& subnets, const Subnet& address) noexcept
+{
+    for(const Subnet& subnet: subnets) {
+        if(Contains(subnet, address))
+            return true;
+    }
+
+    return false;
+}
+
+bool IcePolicy::allows(const std::string& candidate) const noexcept
+{
+    Candidate parsed;
+    if(!ParseCandidate(candidate, &parsed))
+        return true;
+
+    switch(_transportPolicy) {
+    case IceConfig::TransportPolicy::Relay:
+        if(parsed.type != "relay")
+            return false;
+        break;
+    case IceConfig::TransportPolicy::Host:
+        if(parsed.type != "host")
+            return false;
+        break;
+    default:
+        break;
+    }
+
+    // unresolved (mDNS) addresses can't match allow lists
+    Subnet address;
+    const bool addressParsed = ParseSubnet(parsed.address, &address);
+    if(!_allowedAddresses.empty() &&
+       (!addressParsed || !ContainsAny(_allowedAddresses, address)))
+    {
+        return false;
+    }
+    if(addressParsed && ContainsAny(_deniedAddresses, address))
+        return false;
+
+    // interface filters are applied to local base address,
+    // relay candidates don't have one
+    const std::string* baseAddress = nullptr;
+    if(parsed.type == "host")
+        baseAddress = &parsed.address;
+    else if(parsed.type == "srflx" || parsed.type == "prflx")
+        baseAddress = &parsed.relatedAddress;
+
+    if(!baseAddress)
+        return true;
+
+    Subnet base;
+    const bool baseParsed = ParseSubnet(*baseAddress, &base);
+    if(_filterAllowedInterfaces &&
+       (!baseParsed || !ContainsAny(_allowedInterfaceAddresses, base)))
+    {
+        return false;
+    }
+    if(baseParsed && ContainsAny(_deniedInterfaceAddresses, base))
+        return false;
+
+    return true;
+}
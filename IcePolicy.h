@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+
+struct IceConfig
+{
+    enum class TransportPolicy {
+        All,
+        Relay,
+        Host,
+    };
+
+    TransportPolicy transportPolicy = TransportPolicy::All;
+
+    // empty - any
+    std::vector<std::string> allowedInterfaces;
+    std::vector<std::string> deniedInterfaces;
+
+    // "address" or "address/prefix", empty - any
+    std::vector<std::string> allowedAddresses;
+    std::vector<std::string> deniedAddresses;
+
+    unsigned gatherTimeout = 0; // ms, 0 - wait for the end of gathering
+};
+
+// Decides which local ICE candidates are trickled to Janus
+class IcePolicy
+{
+public:
+    // interfaces are resolved to addresses at construction time
+    explicit IcePolicy(const IceConfig&) noexcept;
+
+    bool allows(const std::string& candidate) const noexcept;
+
+private:
+    struct Subnet
+    {
+        int family;
+        guint8 address[16];
+        unsigned prefix;
+    };
+
+    static bool ParseSubnet(const std::string&, Subnet*) noexcept;
+    static bool Contains(const Subnet& subnet, const Subnet& address) noexcept;
+    static bool ContainsAny(const std::vector<Subnet>&, const Subnet& address) noexcept;
+
+    void resolveInterfaces(const IceConfig&) noexcept;
+
+private:
+    const IceConfig::TransportPolicy _transportPolicy;
+
+    const bool _filterAllowedInterfaces;
+    std::vector<Subnet> _allowedInterfaceAddresses;
+    std::vector<Subnet> _deniedInterfaceAddresses;
+
+    std::vector<Subnet> _allowedAddresses;
+    std::vector<Subnet> _deniedAddresses;
+};
@@ -0,0 +1,253 @@
+#include "JanusFrame.h"
+
+#include <cstring>
+
+
+namespace {
+
+struct Token
+{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    bool escaped = false;
+};
+
+inline bool Equals(const Token& token, const char* literal, size_t literalSize)
+{
+    return !token.escaped &&
+        static_cast<size_t>(token.end - token.begin) == literalSize &&
+        0 == memcmp(token.begin, literal, literalSize);
+}
+
+template<size_t N>
+inline bool Equals(const Token& token, const char (&literal)[N])
+{
+    return Equals(token, literal, N - 1);
+}
+
+inline const char* SkipSpaces(const char* c, const char* end)
+{
+    while(c != end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n'))
+        ++c;
+
+    return c;
+}
+
+// c points to opening quote
+const char* ScanString(const char* c, const char* end, Token* token)
+{
+    ++c;
+    token->begin = c;
+    token->escaped = false;
+
+    for(; c != end; ++c) {
+        if(*c == '"') {
+            token->end = c;
+            return c + 1;
+        }
+
+        if(*c == '\\') {
+            token->escaped = true;
+            if(++c == end)
+                break;
+        }
+    }
+
+    return nullptr;
+}
+
+// c points to opening '{' or '['
+const char* SkipContainer(const char* c, const char* end)
+{
+    unsigned depth = 0;
+    for(; c != end; ++c) {
+        switch(*c) {
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        case '}':
+        case ']':
+            if(--depth == 0)
+                return c + 1;
+            break;
+        case '"': {
+            Token token;
+            c = ScanString(c, end, &token);
+            if(!c)
+                return nullptr;
+            --c;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+const char* ScanScalar(const char* c, const char* end, Token* token)
+{
+    token->begin = c;
+    token->escaped = false;
+
+    while(c != end && *c != ',' && *c != '}' &&
+          *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n')
+    {
+        ++c;
+    }
+
+    token->end = c;
+
+    return token->begin != c ? c : nullptr;
+}
+
+bool ParseInteger(const Token& token, json_int_t* value)
+{
+    const char* c = token.begin;
+    bool negative = false;
+    if(c != token.end && *c == '-') {
+        negative = true;
+        ++c;
+    }
+
+    if(c == token.end)
+        return false;
+
+    json_int_t result = 0;
+    for(; c != token.end; ++c) {
+        if(*c < '0' || *c > '9')
+            return false;
+
+        result = result * 10 + (*c - '0');
+    }
+
+    *value = negative ? -result : result;
+
+    return true;
+}
+
+bool ParseTransactionId(const Token& token, TransactionId* transaction)
+{
+    if(token.escaped || token.begin == token.end)
+        return false;
+
+    TransactionId result = 0;
+    for(const char* c = token.begin; c != token.end; ++c) {
+        if(*c < '0' || *c > '9')
+            return false;
+
+        result = result * 10 + (*c - '0');
+    }
+
+    *transaction = result;
+
+    return result != 0;
+}
+
+JanusFrame::Type ParseType(const Token& token)
+{
+    if(Equals(token, "ack"))
+        return JanusFrame::Type::Ack;
+    if(Equals(token, "success"))
+        return JanusFrame::Type::Success;
+    if(Equals(token, "error"))
+        return JanusFrame::Type::Error;
+    if(Equals(token, "event"))
+        return JanusFrame::Type::Event;
+    if(Equals(token, "trickle"))
+        return JanusFrame::Type::Trickle;
+
+    return JanusFrame::Type::Other;
+}
+
+}
+
+JanusFrame::JanusFrame(const char* data, size_t size) noexcept :
+    _data(data), _size(size)
+{
+}
+
+bool JanusFrame::parse() noexcept
+{
+    const char* end = _data + _size;
+    const char* c = SkipSpaces(_data, end);
+    if(c == end || *c != '{')
+        return false;
+
+    c = SkipSpaces(c + 1, end);
+    if(c != end && *c == '}')
+        return true;
+
+    while(c != end) {
+        Token key;
+        if(*c != '"' || !(c = ScanString(c, end, &key)))
+            return false;
+
+        c = SkipSpaces(c, end);
+        if(c == end || *c != ':')
+            return false;
+
+        c = SkipSpaces(c + 1, end);
+        if(c == end)
+            return false;
+
+        Token value;
+        bool isString = false;
+        switch(*c) {
+        case '"':
+            c = ScanString(c, end, &value);
+            isString = true;
+            break;
+        case '{':
+        case '[':
+            c = SkipContainer(c, end);
+            break;
+        default:
+            c = ScanScalar(c, end, &value);
+            break;
+        }
+
+        if(!c)
+            return false;
+
+        if(Equals(key, "janus")) {
+            if(isString)
+                _type = ParseType(value);
+        } else if(Equals(key, "transaction")) {
+            if(isString) {
+                _hasTransaction = value.begin != value.end;
+                ParseTransactionId(value, &_transaction);
+            }
+        } else if(Equals(key, "session_id")) {
+            _hasSession = !isString && ParseInteger(value, &_session);
+        }
+
+        c = SkipSpaces(c, end);
+        if(c == end)
+            return false;
+
+        if(*c == '}')
+            return true;
+
+        if(*c != ',')
+            return false;
+
+        c = SkipSpaces(c + 1, end);
+    }
+
+    return false;
+}
+
+const JsonPtr& JanusFrame::json() noexcept
+{
+    if(!_jsonParsed) {
+        _jsonParsed = true;
+
+        json_error_t jsonError;
+        _jsonPtr.reset(json_loadb(_data, _size, 0, &jsonError));
+    }
+
+    return _jsonPtr;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+
+#include <jansson.h>
+
+#include "CxxPtr/JanssonPtr.h"
+
+#include "TransactionTable.h"
+
+
+// Incoming Janus message.
+// Only top level fields required for routing and dispatch are decoded
+// (without allocations), full JSON tree is built on demand.
+class JanusFrame
+{
+public:
+    enum class Type {
+        Other,
+        Ack,
+        Success,
+        Error,
+        Event,
+        Trickle,
+    };
+
+    JanusFrame(const char* data, size_t size) noexcept;
+
+    // shallow scan of top level object
+    bool parse() noexcept;
+
+    Type type() const noexcept { return _type; }
+
+    bool hasTransaction() const noexcept { return _hasTransaction; }
+    // 0 if transaction was not issued by us
+    TransactionId transaction() const noexcept { return _transaction; }
+
+    bool hasSession() const noexcept { return _hasSession; }
+    json_int_t session() const noexcept { return _session; }
+
+    // parses whole message on first call
+    const JsonPtr& json() noexcept;
+
+private:
+    const char *const _data;
+    const size_t _size;
+
+    Type _type = Type::Other;
+    bool _hasTransaction = false;
+    TransactionId _transaction = 0;
+    bool _hasSession = false;
+    json_int_t _session = 0;
+
+    bool _jsonParsed = false;
+    JsonPtr _jsonPtr;
+};
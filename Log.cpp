@@ -8,7 +8,7 @@ static std::shared_ptr<spdlog::logger> Logger;
 
 void InitJanusClientLogger(spdlog::level::level_enum level)
 {
-    spdlog::sink_ptr sink = std::make_shared<spdlog::sinks::stdout_sink_st>();
+    spdlog::sink_ptr sink = std::make_shared<spdlog::sinks::stdout_sink_mt>();
 
     Logger = std::make_shared<spdlog::logger>("JanusVideoroomClient", sink);
 
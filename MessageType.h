@@ -10,4 +10,6 @@ enum class MessageType {
     JoinAndConfigure,
     Trickle,
     ListParticipants,
+    Claim,
+    ListRooms,
 };
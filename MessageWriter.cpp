@@ -0,0 +1,208 @@
+#include "MessageWriter.h"
+
+#include <cstring>
+
+#include <libwebsockets.h>
+
+
+MessageWriter::MessageWriter() noexcept
+{
+    clear();
+}
+
+void MessageWriter::clear() noexcept
+{
+    _buffer.resize(LWS_PRE);
+    _needSeparator = false;
+}
+
+void MessageWriter::separator() noexcept
+{
+    if(_needSeparator)
+        _buffer.push_back(',');
+}
+
+void MessageWriter::key(const char* name) noexcept
+{
+    separator();
+    appendEscaped(name, strlen(name));
+    _buffer.push_back(':');
+    _needSeparator = false;
+}
+
+void MessageWriter::append(const char* data, size_t size) noexcept
+{
+    _buffer.insert(_buffer.end(), data, data + size);
+}
+
+void MessageWriter::appendEscaped(const char* value, size_t size) noexcept
+{
+    static const char hex[] = "0123456789abcdef";
+
+    _buffer.push_back('"');
+
+    const char* chunkBegin = value;
+    for(const char* c = value; c != value + size; ++c) {
+        const unsigned char uc = static_cast<unsigned char>(*c);
+        if(uc >= 0x20 && uc != '"' && uc != '\\')
+            continue;
+
+        append(chunkBegin, c - chunkBegin);
+        chunkBegin = c + 1;
+
+        switch(uc) {
+        case '"': append("\\\"", 2); break;
+        case '\\': append("\\\\", 2); break;
+        case '\r': append("\\r", 2); break;
+        case '\n': append("\\n", 2); break;
+        case '\t': append("\\t", 2); break;
+        default: {
+            const char escaped[] = { '\\', 'u', '0', '0', hex[uc >> 4], hex[uc & 0xF] };
+            append(escaped, sizeof(escaped));
+            break;
+        }
+        }
+    }
+    append(chunkBegin, value + size - chunkBegin);
+
+    _buffer.push_back('"');
+}
+
+void MessageWriter::appendInteger(json_int_t value) noexcept
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+
+    unsigned long long absValue =
+        value < 0 ?
+            0ull - static_cast<unsigned long long>(value) :
+            static_cast<unsigned long long>(value);
+    do {
+        *--begin = static_cast<char>('0' + absValue % 10);
+        absValue /= 10;
+    } while(absValue);
+
+    if(value < 0)
+        *--begin = '-';
+
+    append(begin, end - begin);
+}
+
+MessageWriter& MessageWriter::beginObject() noexcept
+{
+    separator();
+    _buffer.push_back('{');
+    _needSeparator = false;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::beginObject(const char* name) noexcept
+{
+    key(name);
+    return beginObject();
+}
+
+MessageWriter& MessageWriter::endObject() noexcept
+{
+    _buffer.push_back('}');
+    _needSeparator = true;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::beginArray(const char* name) noexcept
+{
+    key(name);
+    _buffer.push_back('[');
+    _needSeparator = false;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::endArray() noexcept
+{
+    _buffer.push_back(']');
+    _needSeparator = true;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::string(const char* name, const char* value) noexcept
+{
+    key(name);
+    appendEscaped(value, strlen(value));
+    _needSeparator = true;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::string(const char* name, const std::string& value) noexcept
+{
+    key(name);
+    appendEscaped(value.data(), value.size());
+    _needSeparator = true;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::integer(const char* name, json_int_t value) noexcept
+{
+    key(name);
+    appendInteger(value);
+    _needSeparator = true;
+
+    return *this;
+}
+
+MessageWriter& MessageWriter::boolean(const char* name, bool value) noexcept
+{
+    key(name);
+    if(value)
+        append("true", 4);
+    else
+        append("false", 5);
+    _needSeparator = true;
+
+    return *this;
+}
+
+bool MessageWriter::dump(const json_t* json) noexcept
+{
+    separator();
+
+    const int result =
+        json_dump_callback(
+            json,
+            [] (const char* buffer, size_t size, void* data) -> int {
+                static_cast<MessageWriter*>(data)->append(buffer, size);
+                return 0;
+            },
+            this,
+            JSON_COMPACT);
+
+    _needSeparator = true;
+
+    return result == 0;
+}
+
+bool MessageWriter::empty() const noexcept
+{
+    return _buffer.size() <= LWS_PRE;
+}
+
+const char* MessageWriter::data() const noexcept
+{
+    return _buffer.data() + LWS_PRE;
+}
+
+size_t MessageWriter::size() const noexcept
+{
+    return _buffer.size() - LWS_PRE;
+}
+
+MessageWriter::Buffer* MessageWriter::buffer() noexcept
+{
+    return &_buffer;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <jansson.h>
+
+
+// Writes compact JSON directly into send buffer,
+// reserving LWS_PRE bytes of headroom required by lws_write.
+class MessageWriter
+{
+public:
+    typedef std::vector<char> Buffer;
+
+    MessageWriter() noexcept;
+
+    void clear() noexcept;
+
+    MessageWriter& beginObject() noexcept;
+    MessageWriter& beginObject(const char* name) noexcept;
+    MessageWriter& endObject() noexcept;
+
+    MessageWriter& beginArray(const char* name) noexcept;
+    MessageWriter& endArray() noexcept;
+
+    MessageWriter& string(const char* name, const char* value) noexcept;
+    MessageWriter& string(const char* name, const std::string& value) noexcept;
+    MessageWriter& integer(const char* name, json_int_t value) noexcept;
+    MessageWriter& boolean(const char* name, bool value) noexcept;
+
+    // appends jansson tree in compact form
+    bool dump(const json_t*) noexcept;
+
+    bool empty() const noexcept;
+    const char* data() const noexcept;
+    size_t size() const noexcept;
+
+    // buffer with headroom, can be swapped with another one
+    Buffer* buffer() noexcept;
+
+private:
+    void separator() noexcept;
+    void key(const char* name) noexcept;
+    void append(const char* data, size_t size) noexcept;
+    void appendEscaped(const char* value, size_t size) noexcept;
+    void appendInteger(json_int_t) noexcept;
+
+private:
+    Buffer _buffer;
+    bool _needSeparator = false;
+};
@@ -0,0 +1,86 @@
+#include "Pacer.h"
+
+#include <algorithm>
+
+
+namespace {
+
+enum {
+    MEASURE_WINDOW = 500000, // us
+};
+
+// weight of the last window in average bitrate
+const double RateSmoothing = 0.25;
+
+}
+
+Pacer::Pacer(double factor, unsigned maxDelay) noexcept :
+    _factor(std::max(factor, 1.0)),
+    _maxDelay(static_cast<gint64>(maxDelay) * 1000)
+{
+}
+
+void Pacer::measure(gsize size, gint64 now) noexcept
+{
+    if(_windowStart == 0)
+        _windowStart = now;
+
+    _windowBytes += size;
+
+    const gint64 elapsed = now - _windowStart;
+    if(elapsed < MEASURE_WINDOW)
+        return;
+
+    const double windowRate = _windowBytes * 1000000.0 / elapsed;
+    _bytesPerSecond =
+        _bytesPerSecond > 0 ?
+            _bytesPerSecond * (1 - RateSmoothing) + windowRate * RateSmoothing :
+            windowRate;
+
+    _windowStart = now;
+    _windowBytes = 0;
+}
+
+gint64 Pacer::schedule(gsize size, gint64 arrivalTime) noexcept
+{
+    measure(size, arrivalTime);
+
+    // nothing is known about stream bitrate yet
+    if(_bytesPerSecond <= 0)
+        return 0;
+
+    if(_nextSendTime < arrivalTime)
+        _nextSendTime = arrivalTime;
+
+    gint64 delay = _nextSendTime - arrivalTime;
+    if(delay > _maxDelay) {
+        // out of latency budget, so the rest of burst goes as is
+        delay = _maxDelay;
+        _nextSendTime = arrivalTime + _maxDelay;
+    }
+
+    _nextSendTime += static_cast<gint64>(size * 1000000.0 / (_bytesPerSecond * _factor));
+
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    ++_packets;
+    _delaySum += delay;
+    _maxObservedDelay = std::max(_maxObservedDelay, delay);
+
+    return delay;
+}
+
+Pacer::Stats Pacer::takeStats() noexcept
+{
+    std::lock_guard<std::mutex> lock(_statsMutex);
+
+    const Stats stats {
+        _packets,
+        _packets ? _delaySum / static_cast<gint64>(_packets) : 0,
+        _maxObservedDelay };
+
+    _packets = 0;
+    _delaySum = 0;
+    _maxObservedDelay = 0;
+
+    return stats;
+}
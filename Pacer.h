@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mutex>
+
+#include <glib.h>
+
+
+// Spreads packets over time at multiple of measured stream bitrate,
+// so keyframe doesn't leave as single burst.
+// Delay added to packet since it's arrival is bounded by maxDelay.
+class Pacer
+{
+public:
+    struct Stats
+    {
+        guint64 packets;
+        gint64 averageDelay; // us
+        gint64 maxDelay; // us
+    };
+
+    Pacer(double factor, unsigned maxDelay /* ms */) noexcept;
+
+    // returns how long (us) since arrivalTime packet should be held
+    gint64 schedule(gsize size, gint64 arrivalTime) noexcept;
+
+    // stats since previous call
+    Stats takeStats() noexcept;
+
+private:
+    void measure(gsize size, gint64 now) noexcept;
+
+private:
+    const double _factor;
+    const gint64 _maxDelay;
+
+    gint64 _windowStart = 0;
+    gsize _windowBytes = 0;
+    double _bytesPerSecond = 0;
+
+    gint64 _nextSendTime = 0;
+
+    std::mutex _statsMutex;
+    guint64 _packets = 0;
+    gint64 _delaySum = 0;
+    gint64 _maxObservedDelay = 0;
+};
@@ -0,0 +1,78 @@
+#include "ReceiveBuffer.h"
+
+#include <cstring>
+#include <algorithm>
+
+
+namespace {
+
+enum {
+    MIN_CAPACITY = 4 * 1024,
+    // capacity is dropped to observed peak
+    // if so many messages in a row were much smaller
+    SHRINK_AFTER = 64,
+    SHRINK_FACTOR = 4,
+};
+
+}
+
+void ReceiveBuffer::reserve(size_t required) noexcept
+{
+    if(required <= _buffer.size())
+        return;
+
+    size_t capacity = std::max<size_t>(_buffer.size(), MIN_CAPACITY);
+    while(capacity < required)
+        capacity *= 2;
+
+    _buffer.resize(capacity);
+}
+
+bool ReceiveBuffer::onReceive(lws* wsi, const void* in, size_t len) noexcept
+{
+    if(lws_is_first_fragment(wsi)) {
+        _size = 0;
+        _fragments = 0;
+    }
+
+    // libwebsockets knows how much is left of current frame,
+    // so reserve it at once
+    const size_t remaining = lws_remaining_packet_payload(wsi);
+    reserve(std::max(_size + len + remaining, _peakSize));
+
+    memcpy(_buffer.data() + _size, in, len);
+    _size += len;
+    ++_fragments;
+
+    return lws_is_final_fragment(wsi) && remaining == 0;
+}
+
+void ReceiveBuffer::clear() noexcept
+{
+    if(_size > _peakSize)
+        _peakSize = _size;
+    else
+        _peakSize -= (_peakSize - _size) / SHRINK_AFTER;
+
+    if(_buffer.size() > MIN_CAPACITY &&
+       _buffer.size() > _peakSize * SHRINK_FACTOR)
+    {
+        if(++_oversizedCount >= SHRINK_AFTER) {
+            std::vector<char>(std::max<size_t>(_peakSize, MIN_CAPACITY)).swap(_buffer);
+            _oversizedCount = 0;
+        }
+    } else
+        _oversizedCount = 0;
+
+    _size = 0;
+    _fragments = 0;
+}
+
+void ReceiveBuffer::reset() noexcept
+{
+    std::vector<char>().swap(_buffer);
+    _size = 0;
+    _fragments = 0;
+    _peakSize = 0;
+    _oversizedCount = 0;
+}
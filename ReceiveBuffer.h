@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <libwebsockets.h>
+
+
+// Per connection arena gathering WebSocket message fragments.
+// Capacity follows observed message sizes,
+// so large messages (like SDP) are received without repeated reallocations.
+class ReceiveBuffer
+{
+public:
+    // returns true when message is complete
+    bool onReceive(lws*, const void* in, size_t len) noexcept;
+
+    const char* data() const noexcept { return _buffer.data(); }
+    size_t size() const noexcept { return _size; }
+    unsigned fragments() const noexcept { return _fragments; }
+
+    // to be called after complete message is processed
+    void clear() noexcept;
+    // drops everything including allocated memory
+    void reset() noexcept;
+
+private:
+    void reserve(size_t required) noexcept;
+
+private:
+    std::vector<char> _buffer;
+    size_t _size = 0;
+    unsigned _fragments = 0;
+
+    size_t _peakSize = 0; // decaying peak of observed message sizes
+    unsigned _oversizedCount = 0;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+
+
+// Optional extension of WebRTCPeer
+// able to recover media path without peer recreation
+class RestartablePeer
+{
+public:
+    enum class ConnectionState {
+        Connected,
+        IceFailed, // can be recovered with ICE restart
+        Failed,
+    };
+
+    typedef std::function<void (ConnectionState)> ConnectionStateChanged;
+
+    virtual ~RestartablePeer() {}
+
+    virtual void setConnectionStateCallback(const ConnectionStateChanged&) noexcept = 0;
+
+    // "prepared" callback is called again with new local SDP
+    virtual bool restartIce() noexcept = 0;
+};
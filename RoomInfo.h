@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Videocodec.h"
+
+
+// what Janus room allows to publish, discovered before join
+struct RoomInfo
+{
+    Videocodecs videocodecs; // empty if unknown
+    unsigned bitrate = 0; // kbit/s, 0 - unknown or unlimited
+};
@@ -1,19 +1,78 @@
 #include "Session.h"
 
-#include "CxxPtr/CPtr.h"
+#include <cstring>
+
 #include "CxxPtr/JanssonPtr.h"
 
+#include "HandshakeLimit.h"
+#include "Log.h"
+
 
 namespace {
 
 enum {
     KEEPALIVE_TIMEOUT = 30,
-    TIMEOUT_CHECK_INTERVAL = 15,
-    UPDATE_PARTICIPANTS_INTERVAL = 60,
+    TIMEOUT_CHECK_INTERVAL = 1000, // ms
+    UPDATE_PARTICIPANTS_INTERVAL = 60 * 1000, // ms
+    // to retry if handshakes limit is reached (ms)
+    HANDSHAKE_RETRY_MIN_DELAY = 100,
+    HANDSHAKE_RETRY_MAX_DELAY = 1000,
+    // to get connected again after ICE restart (ms)
+    ICE_RESTART_TIMEOUT = 15 * 1000,
 };
 
+const auto Log = ClientLog;
+
 char const * const Plugin = "janus.plugin.videoroom";
 
+// how long to wait for Janus reply (in seconds)
+gint64 ReplyTimeout(MessageType type)
+{
+    switch(type) {
+    case MessageType::Publish:
+    case MessageType::JoinAndConfigure:
+        // Janus has to process SDP, so give it more time
+        return 20;
+    default:
+        return 10;
+    }
+}
+
+// Session can live on any worker thread,
+// so timeouts are attached to thread default main context.
+GSourcePtr AttachSource(GSource* source, GSourceFunc callback, gpointer userData)
+{
+    GSourcePtr sourcePtr(source);
+    g_source_set_callback(sourcePtr.get(), callback, userData, nullptr);
+    g_source_attach(sourcePtr.get(), g_main_context_get_thread_default());
+
+    return sourcePtr;
+}
+
+inline GSourcePtr AttachTimeoutMs(guint interval, GSourceFunc callback, gpointer userData)
+{
+    return AttachSource(g_timeout_source_new(interval), callback, userData);
+}
+
+const char EndOfCandidates[] = "a=end-of-candidates";
+
+const std::deque<std::string> NoIceServers;
+
+// ICE restart is done only if ufrag is changed
+std::string IceUfrag(const std::string& sdp)
+{
+    static const char attribute[] = "a=ice-ufrag:";
+
+    const std::string::size_type begin = sdp.find(attribute);
+    if(begin == std::string::npos)
+        return std::string();
+
+    const std::string::size_type valueBegin = begin + sizeof(attribute) - 1;
+    const std::string::size_type valueEnd = sdp.find_first_of("\r\n", valueBegin);
+
+    return sdp.substr(valueBegin, valueEnd == std::string::npos ? valueEnd : valueEnd - valueBegin);
+}
+
 std::string ExtractString(json_t* json, const char* name)
 {
     json_t* valueJson = json_object_get(json, name);
@@ -32,9 +91,17 @@ json_int_t ExtractInt(json_t* json, const char* name)
     return 0;
 }
 
-inline std::string ExtractTransaction(const JsonPtr& jsonMessagePtr)
+inline TransactionId ExtractTransaction(const JsonPtr& jsonMessagePtr)
 {
-    return ExtractString(jsonMessagePtr.get(), "transaction");
+    json_t* valueJson = json_object_get(jsonMessagePtr.get(), "transaction");
+    TransactionId transaction;
+    if(valueJson && json_is_string(valueJson) &&
+       ParseTransaction(json_string_value(valueJson), &transaction))
+    {
+        return transaction;
+    }
+
+    return 0;
 }
 
 inline json_int_t ExtractSession(const JsonPtr& jsonMessagePtr)
@@ -42,118 +109,323 @@ inline json_int_t ExtractSession(const JsonPtr& jsonMessagePtr)
     return ExtractInt(jsonMessagePtr.get(), "session_id");
 }
 
-inline std::string ExtractJanus(const JsonPtr& jsonMessagePtr)
+inline bool IsJanus(const JsonPtr& jsonMessagePtr, const char* janus)
 {
-    return ExtractString(jsonMessagePtr.get(), "janus");
+    json_t* valueJson = json_object_get(jsonMessagePtr.get(), "janus");
+    return valueJson && json_is_string(valueJson) &&
+        0 == strcmp(json_string_value(valueJson), janus);
 }
 
 }
 
 Session::Session(
     const Config* config,
-    const std::function<std::unique_ptr<WebRTCPeer> ()>& createPeer,
-    const std::function<void (const char*)>& sendMessage) noexcept:
-    _config(config), _createPeer(createPeer), _sendMessage(sendMessage),
-    _lastMessageTimer(g_timer_new())
-{
-    const GSourceFunc timeoutCallback =
-        [] (gpointer userData) -> gboolean {
-            static_cast<Session*>(userData)->checkTimeout();
-            return TRUE;
-        };
-
-    _keepaliveTimeout =
-        g_timeout_add_seconds(
-            TIMEOUT_CHECK_INTERVAL,
-            timeoutCallback, this);
+    const StreamConfig* streamConfig,
+    const std::function<std::unique_ptr<WebRTCPeer> (const RoomInfo&)>& createPeer,
+    const std::function<bool (MessageWriter::Buffer*, bool keepalive)>& sendMessage) noexcept:
+    _config(config), _streamConfig(streamConfig),
+    _createPeer(createPeer), _sendMessage(sendMessage),
+    _checkTimeoutTimer(
+        [this] () {
+            _checkTimeoutTimer.start(TIMEOUT_CHECK_INTERVAL);
+            checkTimeout();
+        }),
+    _updateParticipantsTimer(
+        [this] () {
+            _updateParticipantsTimer.start(UPDATE_PARTICIPANTS_INTERVAL);
+            updateParticipants();
+        }),
+    _lastMessageTime(g_get_monotonic_time()),
+    _icePolicy(config->ice)
+{
+    // random phase to not wake up all sessions at the same tick
+    _checkTimeoutTimer.start(g_random_int_range(0, TIMEOUT_CHECK_INTERVAL));
 
-    if(_config->trackParticipants) {
-        const GSourceFunc updateParticipantsTimeoutCallback =
-            [] (gpointer userData) -> gboolean {
-                static_cast<Session*>(userData)->updateParticipants();
-                return TRUE;
-            };
-
-        _updateParticipantsTimeout =
-            g_timeout_add_seconds(
-                UPDATE_PARTICIPANTS_INTERVAL,
-                updateParticipantsTimeoutCallback, this);
-    }
+    if(_config->trackParticipants)
+        _updateParticipantsTimer.start(g_random_int_range(0, UPDATE_PARTICIPANTS_INTERVAL));
 }
 
 Session::~Session()
 {
-    g_source_remove(_keepaliveTimeout);
+    if(_trickleTimeoutPtr)
+        g_source_destroy(_trickleTimeoutPtr.get());
+
+    if(_handshakeRetryTimeoutPtr)
+        g_source_destroy(_handshakeRetryTimeoutPtr.get());
+
+    if(_gatherTimeoutPtr)
+        g_source_destroy(_gatherTimeoutPtr.get());
+
+    if(_iceRestartTimeoutPtr)
+        g_source_destroy(_iceRestartTimeoutPtr.get());
+
+    finishHandshake();
+}
+
+json_int_t Session::janusSession() const noexcept
+{
+    return _session;
+}
+
+bool Session::isTransactionPending(TransactionId transaction) const noexcept
+{
+    return _sentMessages.contains(transaction);
 }
 
 void Session::disconnect()
 {
-    _sendMessage(nullptr);
+    // connection can be shared with other sessions,
+    // so it's required to destroy Janus session explicitly
+    if(_session != 0)
+        sendDestroySession();
+
+    _sendMessage(nullptr, false);
 }
 
-void Session::sendMessage(const JsonPtr& jsonMessagePtr)
+bool Session::sendMessage(bool keepalive)
 {
-    CharPtr messagePtr(json_dumps(jsonMessagePtr.get(), JSON_INDENT(2)));
+    _lastMessageTime = g_get_monotonic_time();
 
-    g_timer_reset(_lastMessageTimer.get());
+    const bool queued = _sendMessage(_writer.buffer(), keepalive);
+    _writer.clear();
 
-    _sendMessage(messagePtr.get());
+    return queued;
 }
 
-void Session::sendMessage(MessageType messageType, const JsonPtr& jsonMessagePtr)
+void Session::sendMessage(MessageType messageType, TransactionId transaction)
+{
+    if(transaction != 0 &&
+       !_sentMessages.add(
+            transaction,
+            messageType,
+            g_get_monotonic_time(),
+            ReplyTimeout(messageType) * G_USEC_PER_SEC))
+    {
+        Log()->error("Too many requests waiting for Janus reply. Disconnecting...");
+        _writer.clear();
+        disconnect();
+        return;
+    }
+
+    if(!sendMessage(messageType == MessageType::Keepalive))
+        _sentMessages.remove(transaction);
+}
+
+void Session::sendMessage(const JsonPtr& jsonMessagePtr)
 {
-    const std::string transaction = ExtractTransaction(jsonMessagePtr);
-    if(!transaction.empty())
-        _sentMessages.emplace(transaction, messageType);
+    _writer.clear();
+    _writer.dump(jsonMessagePtr.get());
 
-    CharPtr messagePtr(json_dumps(jsonMessagePtr.get(), JSON_INDENT(2)));
+    sendMessage();
+}
 
-    g_timer_reset(_lastMessageTimer.get());
+void Session::sendMessage(MessageType messageType, const JsonPtr& jsonMessagePtr)
+{
+    _writer.clear();
+    _writer.dump(jsonMessagePtr.get());
 
-    _sendMessage(messagePtr.get());
+    sendMessage(messageType, ExtractTransaction(jsonMessagePtr));
 }
 
 void Session::sendKeepalive()
 {
-    JsonPtr jsonMessagePtr(json_object());
-    json_t* jsonMessage = jsonMessagePtr.get();
+    const TransactionId transaction = NextTransaction();
 
-    json_object_set_new(
-        jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
-    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
-    json_object_set_new(jsonMessage, "janus", json_string("keepalive"));
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "keepalive")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .endObject();
+
+    sendMessage(MessageType::Keepalive, transaction);
+}
 
-    sendMessage(MessageType::Keepalive, jsonMessagePtr);
+bool Session::fastStart() const noexcept
+{
+    // with participants tracking stream is started on demand only
+    return _config->fastStart && !_config->trackParticipants;
 }
 
 bool Session::onConnected() noexcept
 {
-    sendCreateSession();
+    _lastMessageTime = g_get_monotonic_time();
 
-    g_timer_start(_lastMessageTimer.get());
+    startHandshake();
 
     return true;
 }
 
+void Session::startHandshake()
+{
+    if(!_handshakeAdmitted && !(_handshakeAdmitted = TryAcquireHandshake())) {
+        const guint delay =
+            g_random_int_range(HANDSHAKE_RETRY_MIN_DELAY, HANDSHAKE_RETRY_MAX_DELAY);
+
+        Log()->debug("Too many Janus handshakes in progress. Retrying in {} ms...", delay);
+
+        _handshakeRetryTimeoutPtr =
+            AttachTimeoutMs(
+                delay,
+                [] (gpointer userData) -> gboolean {
+                    Session* self = static_cast<Session*>(userData);
+                    self->_handshakeRetryTimeoutPtr.reset();
+                    self->startHandshake();
+                    return G_SOURCE_REMOVE;
+                }, this);
+
+        return;
+    }
+
+    sendCreateSession();
+
+    // prepare pipeline while Janus session is being set up
+    if(fastStart())
+        startStream();
+}
+
+void Session::finishHandshake()
+{
+    if(!_handshakeAdmitted)
+        return;
+
+    ReleaseHandshake();
+    _handshakeAdmitted = false;
+}
+
 void Session::checkTimeout()
 {
-    if(g_timer_elapsed(_lastMessageTimer.get(), nullptr) > KEEPALIVE_TIMEOUT)
+    if(!_online)
+        return;
+
+    const gint64 now = g_get_monotonic_time();
+
+    TransactionId transaction;
+    MessageType messageType;
+    gint64 sentTime;
+    if(_sentMessages.expired(now, &transaction, &messageType, &sentTime)) {
+        Log()->error(
+            "Janus didn't reply to transaction {} (type {}) for {} ms. Disconnecting...",
+            transaction, static_cast<int>(messageType),
+            (now - sentTime) / 1000);
+        _sentMessages.clear();
+        disconnect();
+        return;
+    }
+
+    if(_session != 0 &&
+       now - _lastMessageTime > KEEPALIVE_TIMEOUT * G_USEC_PER_SEC)
+    {
         sendKeepalive();
+    }
 }
 
-bool Session::handleMessage(const JsonPtr& jsonMessagePtr) noexcept
+bool Session::suspend() noexcept
 {
-    const std::string transaction = ExtractTransaction(jsonMessagePtr);
-    if(!transaction.empty()) {
-        const auto it = _sentMessages.find(transaction);
-        if(it != _sentMessages.end()) {
-            if(ExtractJanus(jsonMessagePtr) == "ack") {
-                switch(it->second) {
+    finishHandshake();
+
+    _online = false;
+    _sentMessages.clear();
+    _writer.clear();
+
+    // replies to requests in flight are lost,
+    // so it's possible to continue only in stable state
+    return _session != 0 && _joined && !_iceRestarting &&
+        (!_offerSent || _answerReceived);
+}
+
+bool Session::resume() noexcept
+{
+    _online = true;
+
+    Log()->info("Claiming Janus session {}...", _session);
+
+    sendClaim();
+
+    _lastMessageTime = g_get_monotonic_time();
+
+    return true;
+}
+
+void Session::sendClaim()
+{
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "claim")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .endObject();
+
+    sendMessage(MessageType::Claim, transaction);
+}
+
+bool Session::handleClaimReply(const JsonPtr& jsonMessagePtr)
+{
+    if(!IsJanus(jsonMessagePtr, "success")) {
+        Log()->info("Janus session {} can't be claimed. Starting from scratch...", _session);
+        return restart();
+    }
+
+    Log()->info("Janus session {} is claimed", _session);
+
+    // candidates gathered while connection was down
+    sendTrickle();
+
+    return true;
+}
+
+bool Session::restart()
+{
+    if(_streamerPtr) {
+        _streamerPtr->stop();
+        _streamerPtr.reset();
+    }
+
+    if(_trickleTimeoutPtr) {
+        g_source_destroy(_trickleTimeoutPtr.get());
+        _trickleTimeoutPtr.reset();
+    }
+    _pendingCandidates.clear();
+
+    if(_gatherTimeoutPtr) {
+        g_source_destroy(_gatherTimeoutPtr.get());
+        _gatherTimeoutPtr.reset();
+    }
+    _candidatesEnded = false;
+
+    stopIceRestart();
+
+    _sentMessages.clear();
+
+    finishHandshake();
+
+    _session = 0;
+    _handleId = 0;
+    _joined = false;
+    _publisherId = 0;
+    _participants.clear();
+    _room = RoomInfo();
+    _streamerPrepared = false;
+    _offerSent = false;
+    _answerReceived = false;
+
+    return onConnected();
+}
+
+bool Session::handleMessage(JanusFrame* frame) noexcept
+{
+    if(frame->hasTransaction()) {
+        const TransactionId transaction = frame->transaction();
+        MessageType messageType;
+        if(_sentMessages.find(transaction, &messageType)) {
+            if(frame->type() == JanusFrame::Type::Ack) {
+                switch(messageType) {
                 case MessageType::Keepalive:
                 case MessageType::Trickle:
                     // any other reply is not expected for such message types
-                    _sentMessages.erase(it);
+                    _sentMessages.remove(transaction);
                 default:
                     break;
                 }
@@ -161,9 +433,13 @@ bool Session::handleMessage(const JsonPtr& jsonMessagePtr) noexcept
                 return true;
             }
 
-            _sentMessages.erase(it);
+            _sentMessages.remove(transaction);
 
-            switch(it->second) {
+            const JsonPtr& jsonMessagePtr = frame->json();
+            if(!jsonMessagePtr)
+                return false;
+
+            switch(messageType) {
             case MessageType::CreateSession:
                 return handleCreateSessionReply(jsonMessagePtr);
             case MessageType::AttachPlugin:
@@ -172,12 +448,18 @@ bool Session::handleMessage(const JsonPtr& jsonMessagePtr) noexcept
                 return handleJoinReply(jsonMessagePtr);
             case MessageType::Publish:
                 return handlePublishReply(jsonMessagePtr);
+            case MessageType::JoinAndConfigure:
+                return handleJoinAndConfigureReply(jsonMessagePtr);
             case MessageType::UnPublish:
                 return handleUnPublishReply(jsonMessagePtr);
             case MessageType::Trickle:
                 return handleTrickleReply(jsonMessagePtr);
             case MessageType::ListParticipants:
                 return handleListParticipantsReply(jsonMessagePtr);
+            case MessageType::Claim:
+                return handleClaimReply(jsonMessagePtr);
+            case MessageType::ListRooms:
+                return handleListRoomsReply(jsonMessagePtr);
             default:
                 break;
             }
@@ -185,7 +467,7 @@ bool Session::handleMessage(const JsonPtr& jsonMessagePtr) noexcept
 
         return false;
     } else
-        return handleEvent(jsonMessagePtr);
+        return handleEvent(frame);
 }
 
 void Session::sendCreateSession()
@@ -195,18 +477,32 @@ void Session::sendCreateSession()
 
     json_object_set_new(
         jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
+        "transaction", json_string(std::to_string(NextTransaction()).c_str()));
     json_object_set_new(jsonMessage, "janus", json_string("create"));
 
     sendMessage(MessageType::CreateSession, jsonMessagePtr);
 }
 
+void Session::sendDestroySession()
+{
+    JsonPtr jsonMessagePtr(json_object());
+    json_t* jsonMessage = jsonMessagePtr.get();
+
+    json_object_set_new(
+        jsonMessage,
+        "transaction", json_string(std::to_string(NextTransaction()).c_str()));
+    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
+    json_object_set_new(jsonMessage, "janus", json_string("destroy"));
+
+    sendMessage(jsonMessagePtr);
+}
+
 bool Session::handleCreateSessionReply(const JsonPtr& jsonMessagePtr)
 {
     if(_session != 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "success")
+    if(!IsJanus(jsonMessagePtr, "success"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -231,7 +527,7 @@ void Session::sendAttachPlugin()
 
     json_object_set_new(
         jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
+        "transaction", json_string(std::to_string(NextTransaction()).c_str()));
     json_object_set_new(jsonMessage, "session_id", json_integer(_session));
     json_object_set_new(jsonMessage, "janus", json_string("attach"));
     json_object_set_new(jsonMessage, "plugin", json_string(Plugin));
@@ -244,7 +540,7 @@ bool Session::handleAttachPluginReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId != 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "success")
+    if(!IsJanus(jsonMessagePtr, "success"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -257,6 +553,76 @@ bool Session::handleAttachPluginReply(const JsonPtr& jsonMessagePtr)
     if(!_handleId)
         return false;
 
+    if(fastStart()) {
+        // otherwise it will be sent from streamerPrepared()
+        if(_streamerPrepared)
+            sendJoinAndConfigure(_streamerPtr->sdp());
+    } else if(_config->negotiateVideocodec)
+        sendListRooms();
+    else
+        sendJoin();
+
+    return true;
+}
+
+void Session::sendListRooms()
+{
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "message")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .integer("handle_id", _handleId)
+        .string("plugin", Plugin)
+        .beginObject("body")
+            .string("request", "list")
+        .endObject()
+        .endObject();
+
+    sendMessage(MessageType::ListRooms, transaction);
+}
+
+bool Session::handleListRoomsReply(const JsonPtr& jsonMessagePtr)
+{
+    if(_session == 0 || _handleId == 0 || _joined)
+        return false;
+
+    _room = RoomInfo();
+
+    json_t* plugindataJson = json_object_get(jsonMessagePtr.get(), "plugindata");
+    json_t* dataJson =
+        plugindataJson ? json_object_get(plugindataJson, "data") : nullptr;
+    json_t* listJson =
+        dataJson ? json_object_get(dataJson, "list") : nullptr;
+
+    // failure is not fatal, stream is published as configured in this case
+    if(IsJanus(jsonMessagePtr, "success") && listJson && json_is_array(listJson)) {
+        size_t index;
+        json_t* roomJson;
+        json_array_foreach(listJson, index, roomJson) {
+            if(ExtractInt(roomJson, "room") != _streamConfig->room)
+                continue;
+
+            // bits per second
+            _room.bitrate = static_cast<unsigned>(ExtractInt(roomJson, "bitrate") / 1000);
+
+            const std::string videocodecs = ExtractString(roomJson, "videocodec");
+            _room.videocodecs = ParseVideocodecs(videocodecs);
+            if(_room.videocodecs.empty()) {
+                Log()->warn(
+                    "Room {} has no supported video codecs: \"{}\"",
+                    _streamConfig->room, videocodecs);
+            } else {
+                Log()->debug(
+                    "Room {} video codecs: \"{}\"",
+                    _streamConfig->room, videocodecs);
+            }
+            break;
+        }
+    }
+
     sendJoin();
 
     return true;
@@ -269,7 +635,7 @@ void Session::sendJoin()
 
     json_object_set_new(
         jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
+        "transaction", json_string(std::to_string(NextTransaction()).c_str()));
     json_object_set_new(jsonMessage, "session_id", json_integer(_session));
     json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
     json_object_set_new(jsonMessage, "janus", json_string("message"));
@@ -280,8 +646,8 @@ void Session::sendJoin()
 
     json_object_set_new(jsonBody, "request", json_string("join"));
     json_object_set_new(jsonBody, "ptype", json_string("publisher"));
-    json_object_set_new(jsonBody, "room", json_integer(_config->room));
-    json_object_set_new(jsonBody, "display", json_string(_config->display.c_str()));
+    json_object_set_new(jsonBody, "room", json_integer(_streamConfig->room));
+    json_object_set_new(jsonBody, "display", json_string(_streamConfig->display.c_str()));
 
     sendMessage(MessageType::Join, jsonMessagePtr);
 }
@@ -291,7 +657,7 @@ bool Session::handleJoinReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId == 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "event")
+    if(!IsJanus(jsonMessagePtr, "event"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -307,43 +673,49 @@ bool Session::handleJoinReply(const JsonPtr& jsonMessagePtr)
     if(ExtractString(dataJson, "videoroom") != "joined")
         return false;
 
-    if(_config->trackParticipants)
+    _joined = true;
+    _publisherId = ExtractInt(dataJson, "id");
+
+    if(_config->trackParticipants) {
+        // stream is started on demand, so handshake is done
+        finishHandshake();
         updateParticipants();
-    else
+    } else
         startStream();
 
     return true;
 }
 
-void Session::sendPublish(const std::string& sdp)
+void Session::sendPublish(const std::string& sdp, bool iceRestart)
 {
-    JsonPtr jsonMessagePtr(json_object());
-    json_t* jsonMessage = jsonMessagePtr.get();
-
-    json_object_set_new(
-        jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
-    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
-    json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
-    json_object_set_new(jsonMessage, "janus", json_string("message"));
-    json_object_set_new(jsonMessage, "plugin", json_string(Plugin));
-
-    json_t* jsonBody = json_object();
-    json_object_set_new(jsonMessage, "body", jsonBody);
-
-    json_object_set_new(jsonBody, "request", json_string("configure"));
-
-    json_object_set_new(jsonBody, "audio", json_boolean(false));
-    json_object_set_new(jsonBody, "video", json_boolean(true));
-    json_object_set_new(jsonBody, "data", json_boolean(false));
-
-    json_t* jsep = json_object();
-    json_object_set_new(jsonMessage, "jsep", jsep);
-
-    json_object_set_new(jsep, "type", json_string("offer"));
-    json_object_set_new(jsep, "sdp", json_string(sdp.c_str()));
-
-    sendMessage(MessageType::Publish, jsonMessagePtr);
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "message")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .integer("handle_id", _handleId)
+        .string("plugin", Plugin)
+        .beginObject("body")
+            .string("request", "configure")
+            .boolean("audio", false)
+            .boolean("video", true)
+            .boolean("data", false);
+    if(iceRestart)
+        _writer.boolean("restart", true);
+    _writer.endObject()
+        .beginObject("jsep")
+            .string("type", "offer")
+            .string("sdp", sdp)
+        .endObject()
+        .endObject();
+
+    _offerSent = true;
+
+    sendMessage(MessageType::Publish, transaction);
+
+    sendTrickle();
 }
 
 bool Session::handlePublishReply(const JsonPtr& jsonMessagePtr)
@@ -351,7 +723,7 @@ bool Session::handlePublishReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId == 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "event")
+    if(!IsJanus(jsonMessagePtr, "event"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -387,42 +759,44 @@ bool Session::handlePublishReply(const JsonPtr& jsonMessagePtr)
 
     _streamerPtr->play();
 
+    _answerReceived = true;
+
+    finishHandshake();
+
     return true;
 }
 
-/*
 void Session::sendJoinAndConfigure(const std::string& sdp)
 {
-    JsonPtr jsonMessagePtr(json_object());
-    json_t* jsonMessage = jsonMessagePtr.get();
-
-    json_object_set_new(
-        jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
-    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
-    json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
-    json_object_set_new(jsonMessage, "janus", json_string("message"));
-    json_object_set_new(jsonMessage, "plugin", json_string(Plugin));
-
-    json_t* jsonBody = json_object();
-    json_object_set_new(jsonMessage, "body", jsonBody);
-
-    json_object_set_new(jsonBody, "request", json_string("joinandconfigure"));
-    json_object_set_new(jsonBody, "ptype", json_string("publisher"));
-    json_object_set_new(jsonBody, "room", json_integer(_config->room));
-    json_object_set_new(jsonBody, "display", json_string(_config->display.c_str()));
-
-    json_object_set_new(jsonBody, "audio", json_boolean(false));
-    json_object_set_new(jsonBody, "video", json_boolean(true));
-    json_object_set_new(jsonBody, "data", json_boolean(false));
-
-    json_t* jsep = json_object();
-    json_object_set_new(jsonMessage, "jsep", jsep);
-
-    json_object_set_new(jsep, "type", json_string("offer"));
-    json_object_set_new(jsep, "sdp", json_string(sdp.c_str()));
-
-    sendMessage(MessageType::JoinAndConfigure, jsonMessagePtr);
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "message")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .integer("handle_id", _handleId)
+        .string("plugin", Plugin)
+        .beginObject("body")
+            .string("request", "joinandconfigure")
+            .string("ptype", "publisher")
+            .integer("room", _streamConfig->room)
+            .string("display", _streamConfig->display)
+            .boolean("audio", false)
+            .boolean("video", true)
+            .boolean("data", false)
+        .endObject()
+        .beginObject("jsep")
+            .string("type", "offer")
+            .string("sdp", sdp)
+        .endObject()
+        .endObject();
+
+    _offerSent = true;
+
+    sendMessage(MessageType::JoinAndConfigure, transaction);
+
+    sendTrickle();
 }
 
 bool Session::handleJoinAndConfigureReply(const JsonPtr& jsonMessagePtr)
@@ -430,7 +804,7 @@ bool Session::handleJoinAndConfigureReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId == 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "event")
+    if(!IsJanus(jsonMessagePtr, "event"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -463,9 +837,13 @@ bool Session::handleJoinAndConfigureReply(const JsonPtr& jsonMessagePtr)
 
     _streamerPtr->play();
 
+    _joined = true;
+    _answerReceived = true;
+
+    finishHandshake();
+
     return true;
 }
-*/
 
 void Session::sendUnPublish()
 {
@@ -474,7 +852,7 @@ void Session::sendUnPublish()
 
     json_object_set_new(
         jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
+        "transaction", json_string(std::to_string(NextTransaction()).c_str()));
     json_object_set_new(jsonMessage, "session_id", json_integer(_session));
     json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
     json_object_set_new(jsonMessage, "janus", json_string("message"));
@@ -492,7 +870,7 @@ bool Session::handleUnPublishReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId == 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "event")
+    if(!IsJanus(jsonMessagePtr, "event"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -514,29 +892,48 @@ bool Session::handleUnPublishReply(const JsonPtr& jsonMessagePtr)
     return true;
 }
 
-void Session::sendTrickle(unsigned mlineIndex, const std::string& candidate)
+void Session::sendTrickle()
 {
-    JsonPtr jsonMessagePtr(json_object());
-    json_t* jsonMessage = jsonMessagePtr.get();
+    if(_trickleTimeoutPtr) {
+        g_source_destroy(_trickleTimeoutPtr.get());
+        _trickleTimeoutPtr.reset();
+    }
 
-    json_object_set_new(
-        jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
-    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
-    json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
-    json_object_set_new(jsonMessage, "janus", json_string("trickle"));
+    // Janus can't accept candidates before offer
+    if(_pendingCandidates.empty() || !_offerSent || !_online)
+        return;
 
-    json_t* candidateJson = json_object();
-    json_object_set_new(jsonMessage, "candidate", candidateJson);
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "trickle")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .integer("handle_id", _handleId)
+        .beginArray("candidates");
+
+    for(const auto& pair: _pendingCandidates) {
+        _writer.beginObject();
+
+        if(pair.second == EndOfCandidates) {
+            _writer.boolean("completed", true);
+        } else {
+            _writer
+                .integer("sdpMLineIndex", pair.first)
+                .string("candidate", pair.second);
+        }
 
-    if(candidate == "a=end-of-candidates") {
-        json_object_set_new(candidateJson, "completed", json_boolean(true));
-    } else {
-        json_object_set_new(candidateJson, "sdpMLineIndex", json_integer(mlineIndex));
-        json_object_set_new(candidateJson, "candidate", json_string(candidate.c_str()));
+        _writer.endObject();
     }
 
-    sendMessage(MessageType::Trickle, jsonMessagePtr);
+    _writer
+        .endArray()
+        .endObject();
+
+    _pendingCandidates.clear();
+
+    sendMessage(MessageType::Trickle, transaction);
 }
 
 bool Session::handleTrickleReply(const JsonPtr& /*jsonMessagePtr*/)
@@ -547,24 +944,22 @@ bool Session::handleTrickleReply(const JsonPtr& /*jsonMessagePtr*/)
 
 void Session::sendListParticipants()
 {
-    JsonPtr jsonMessagePtr(json_object());
-    json_t* jsonMessage = jsonMessagePtr.get();
-
-    json_object_set_new(
-        jsonMessage,
-        "transaction", json_string(std::to_string(_nextTransaction++).c_str()));
-    json_object_set_new(jsonMessage, "session_id", json_integer(_session));
-    json_object_set_new(jsonMessage, "handle_id", json_integer(_handleId));
-    json_object_set_new(jsonMessage, "janus", json_string("message"));
-    json_object_set_new(jsonMessage, "plugin", json_string(Plugin));
-
-    json_t* jsonBody = json_object();
-    json_object_set_new(jsonMessage, "body", jsonBody);
-
-    json_object_set_new(jsonBody, "request", json_string("listparticipants"));
-    json_object_set_new(jsonBody, "room", json_integer(_config->room));
-
-    sendMessage(MessageType::ListParticipants, jsonMessagePtr);
+    const TransactionId transaction = NextTransaction();
+
+    _writer.clear();
+    _writer.beginObject()
+        .string("janus", "message")
+        .string("transaction", std::to_string(transaction))
+        .integer("session_id", _session)
+        .integer("handle_id", _handleId)
+        .string("plugin", Plugin)
+        .beginObject("body")
+            .string("request", "listparticipants")
+            .integer("room", _streamConfig->room)
+        .endObject()
+        .endObject();
+
+    sendMessage(MessageType::ListParticipants, transaction);
 }
 
 bool Session::handleListParticipantsReply(const JsonPtr& jsonMessagePtr)
@@ -572,7 +967,7 @@ bool Session::handleListParticipantsReply(const JsonPtr& jsonMessagePtr)
     if(_session == 0 || _handleId == 0)
         return false;
 
-    if(ExtractJanus(jsonMessagePtr) != "success")
+    if(!IsJanus(jsonMessagePtr, "success"))
         return false;
 
     json_t* jsonMessage = jsonMessagePtr.get();
@@ -595,21 +990,82 @@ bool Session::handleListParticipantsReply(const JsonPtr& jsonMessagePtr)
     if(!json_is_array(participantsJson))
         return false;
 
-    if(json_array_size(participantsJson) > 1)
-        startStream();
-    else
+    _participants.clear();
+
+    size_t index;
+    json_t* participantJson;
+    json_array_foreach(participantsJson, index, participantJson) {
+        const json_int_t id = ExtractInt(participantJson, "id");
+        if(id != 0 && id != _publisherId)
+            _participants.insert(id);
+    }
+
+    updateStreamState();
+
+    return true;
+}
+
+void Session::updateStreamState()
+{
+    if(_participants.empty())
         stopStream();
+    else
+        startStream();
+}
+
+bool Session::handleRoomEvent(const JsonPtr& jsonMessagePtr)
+{
+    json_t* plugindataJson = json_object_get(jsonMessagePtr.get(), "plugindata");
+    if(!plugindataJson)
+        return true;
+
+    json_t* dataJson = json_object_get(plugindataJson, "data");
+    if(!dataJson)
+        return true;
+
+    if(ExtractString(dataJson, "videoroom") != "event")
+        return true;
+
+    // requires "notify_joining" for the room
+    if(json_t* joiningJson = json_object_get(dataJson, "joining")) {
+        const json_int_t id = ExtractInt(joiningJson, "id");
+        if(id != 0 && id != _publisherId)
+            _participants.insert(id);
+    }
+
+    json_t* publishersJson = json_object_get(dataJson, "publishers");
+    if(publishersJson && json_is_array(publishersJson)) {
+        size_t index;
+        json_t* publisherJson;
+        json_array_foreach(publishersJson, index, publisherJson) {
+            const json_int_t id = ExtractInt(publisherJson, "id");
+            if(id != 0 && id != _publisherId)
+                _participants.insert(id);
+        }
+    }
+
+    // "leaving" is "ok" if it's about ourselves
+    if(const json_int_t id = ExtractInt(dataJson, "leaving"))
+        _participants.erase(id);
+
+    // participant can still be in the room, so ask Janus
+    if(ExtractInt(dataJson, "unpublished") != 0)
+        sendListParticipants();
+
+    updateStreamState();
 
     return true;
 }
 
-bool Session::handleEvent(const JsonPtr& jsonMessagePtr)
+bool Session::handleEvent(JanusFrame* frame)
 {
-    json_t* jsonMessage = jsonMessagePtr.get();
+    if(frame->type() == JanusFrame::Type::Trickle) {
+        const JsonPtr& jsonMessagePtr = frame->json();
+        if(!jsonMessagePtr)
+            return false;
 
-    const std::string janus = ExtractJanus(jsonMessagePtr);
+        json_t* jsonMessage = jsonMessagePtr.get();
 
-    if(janus == "trickle") {
         json_t* candidateJson = json_object_get(jsonMessage, "candidate");
 
         json_int_t mLineIndex = ExtractInt(candidateJson, "sdpMLineIndex");
@@ -619,6 +1075,12 @@ bool Session::handleEvent(const JsonPtr& jsonMessagePtr)
             return false;
 
         _streamerPtr->addIceCandidate(mLineIndex, candidate);
+    } else if(frame->type() == JanusFrame::Type::Event && _config->trackParticipants) {
+        const JsonPtr& jsonMessagePtr = frame->json();
+        if(!jsonMessagePtr)
+            return false;
+
+        return handleRoomEvent(jsonMessagePtr);
     }
 
     return true;
@@ -627,15 +1089,172 @@ bool Session::handleEvent(const JsonPtr& jsonMessagePtr)
 void Session::streamerPrepared()
 {
     const std::string sdp = _streamerPtr->sdp();
-    if(!sdp.empty())
-        sendPublish(sdp);
-    else
+    if(sdp.empty()) {
         disconnect();
+        return;
+    }
+
+    const std::string iceUfrag = IceUfrag(sdp);
+
+    if(_iceRestarting) {
+        if(iceUfrag == _iceUfrag) {
+            Log()->warn("ICE restart is not supported by peer. Reconnecting...");
+            disconnect();
+            return;
+        }
+
+        _iceUfrag = iceUfrag;
+        sendPublish(sdp, true);
+        return;
+    }
+
+    _iceUfrag = iceUfrag;
+    _streamerPrepared = true;
+
+    // gathering starts with local description,
+    // so source startup doesn't eat deadline
+    if(!_candidatesEnded)
+        startGatherTimeout();
+
+    if(!fastStart())
+        sendPublish(sdp);
+    else if(_handleId != 0)
+        sendJoinAndConfigure(sdp);
 }
 
 void Session::iceCandidate(unsigned mlineIndex, const std::string& candidate)
 {
-    sendTrickle(mlineIndex, candidate);
+    if(_candidatesEnded)
+        return;
+
+    if(candidate == EndOfCandidates)
+        stopGathering();
+    else if(!_icePolicy.allows(candidate)) {
+        Log()->trace("ICE candidate filtered out: {}", candidate);
+        return;
+    }
+
+    _pendingCandidates.emplace_back(mlineIndex, candidate);
+
+    if(candidate == EndOfCandidates || _config->trickleBatchInterval == 0) {
+        sendTrickle();
+        return;
+    }
+
+    if(_trickleTimeoutPtr)
+        return;
+
+    _trickleTimeoutPtr =
+        AttachTimeoutMs(
+            _config->trickleBatchInterval,
+            [] (gpointer userData) -> gboolean {
+                Session* self = static_cast<Session*>(userData);
+                self->_trickleTimeoutPtr.reset();
+                self->sendTrickle();
+                return G_SOURCE_REMOVE;
+            }, this);
+}
+
+void Session::startGatherTimeout()
+{
+    if(_config->ice.gatherTimeout == 0)
+        return;
+
+    if(_gatherTimeoutPtr)
+        g_source_destroy(_gatherTimeoutPtr.get());
+
+    // late candidates are useless since Janus is waiting for the end of candidates
+    _gatherTimeoutPtr =
+        AttachTimeoutMs(
+            _config->ice.gatherTimeout,
+            [] (gpointer userData) -> gboolean {
+                Session* self = static_cast<Session*>(userData);
+                self->_gatherTimeoutPtr.reset();
+                Log()->debug("ICE gathering deadline reached");
+                self->iceCandidate(0, EndOfCandidates);
+                return G_SOURCE_REMOVE;
+            }, this);
+}
+
+void Session::stopGathering()
+{
+    _candidatesEnded = true;
+
+    if(_gatherTimeoutPtr) {
+        g_source_destroy(_gatherTimeoutPtr.get());
+        _gatherTimeoutPtr.reset();
+    }
+}
+
+void Session::connectionStateChanged(RestartablePeer::ConnectionState state)
+{
+    switch(state) {
+    case RestartablePeer::ConnectionState::Connected:
+        if(_iceRestarting && _answerReceived) {
+            Log()->info("ICE restart succeeded");
+            stopIceRestart();
+        }
+        break;
+    case RestartablePeer::ConnectionState::IceFailed:
+        // already restarting, wait for timeout
+        if(_iceRestarting)
+            break;
+
+        if(!restartIce())
+            disconnect();
+        break;
+    case RestartablePeer::ConnectionState::Failed:
+        Log()->warn("Peer connection failed. Reconnecting...");
+        disconnect();
+        break;
+    }
+}
+
+bool Session::restartIce()
+{
+    RestartablePeer* peer = dynamic_cast<RestartablePeer*>(_streamerPtr.get());
+    if(!peer || !_online || !_answerReceived || _iceRestarting)
+        return false;
+
+    Log()->info("ICE connection failed. Restarting ICE...");
+
+    // candidates of previous ICE generation are useless
+    if(_trickleTimeoutPtr) {
+        g_source_destroy(_trickleTimeoutPtr.get());
+        _trickleTimeoutPtr.reset();
+    }
+    _pendingCandidates.clear();
+    _candidatesEnded = false;
+
+    // new candidates have to wait for new offer
+    _offerSent = false;
+    _answerReceived = false;
+    _iceRestarting = true;
+
+    _iceRestartTimeoutPtr =
+        AttachTimeoutMs(
+            ICE_RESTART_TIMEOUT,
+            [] (gpointer userData) -> gboolean {
+                Session* self = static_cast<Session*>(userData);
+                self->_iceRestartTimeoutPtr.reset();
+                Log()->warn("ICE restart timeout. Reconnecting...");
+                self->disconnect();
+                return G_SOURCE_REMOVE;
+            }, this);
+
+    startGatherTimeout();
+
+    return peer->restartIce();
+}
+
+void Session::stopIceRestart()
+{
+    _iceRestarting = false;
+
+    if(_iceRestartTimeoutPtr) {
+        g_source_destroy(_iceRestartTimeoutPtr.get());
+        _iceRestartTimeoutPtr.reset();
+    }
 }
 
 void Session::eos()
@@ -646,10 +1265,9 @@ void Session::eos()
 
 void Session::updateParticipants()
 {
-    if(_session == 0 || _handleId == 0) {
-        disconnect();
+    // handshake is still in progress (or waits for it's turn)
+    if(!_online || !_joined)
         return;
-    }
 
     sendListParticipants();
 }
@@ -659,10 +1277,21 @@ void Session::startStream()
     if(_streamerPtr)
         return;
 
-    _streamerPtr = _createPeer();
+    _streamerPtr = _createPeer(_room);
 
+    if(RestartablePeer* peer = dynamic_cast<RestartablePeer*>(_streamerPtr.get())) {
+        peer->setConnectionStateCallback(
+            std::bind(
+                &Session::connectionStateChanged,
+                this,
+                std::placeholders::_1));
+    }
+
+    // STUN/TURN servers are useless for host candidates
     _streamerPtr->prepare(
-        _config->iceServers,
+        _config->ice.transportPolicy == IceConfig::TransportPolicy::Host ?
+            NoIceServers :
+            _config->iceServers,
         std::bind(
             &Session::streamerPrepared,
             this),
@@ -684,5 +1313,23 @@ void Session::stopStream()
     _streamerPtr->stop();
     _streamerPtr.reset();
 
+    if(_trickleTimeoutPtr) {
+        g_source_destroy(_trickleTimeoutPtr.get());
+        _trickleTimeoutPtr.reset();
+    }
+    _pendingCandidates.clear();
+
+    if(_gatherTimeoutPtr) {
+        g_source_destroy(_gatherTimeoutPtr.get());
+        _gatherTimeoutPtr.reset();
+    }
+    _candidatesEnded = false;
+
+    stopIceRestart();
+
+    _streamerPrepared = false;
+    _offerSent = false;
+    _answerReceived = false;
+
     sendUnPublish();
 }
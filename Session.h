@@ -1,5 +1,7 @@
 #pragma once
 
+#include <set>
+
 #include "CxxPtr/GlibPtr.h"
 #include "CxxPtr/JanssonPtr.h"
 
@@ -7,6 +9,13 @@
 #include "RtStreaming/WebRTCPeer.h"
 
 #include "MessageType.h"
+#include "MessageWriter.h"
+#include "RoomInfo.h"
+#include "JanusFrame.h"
+#include "TransactionTable.h"
+#include "TimerWheel.h"
+#include "IcePolicy.h"
+#include "RestartablePeer.h"
 
 
 class Session
@@ -14,16 +23,30 @@ class Session
 public:
     Session(
         const Config*,
-        const std::function<std::unique_ptr<WebRTCPeer> ()>& createPeer,
-        const std::function<void (const char*)>& sendMessage) noexcept;
+        const StreamConfig*,
+        const std::function<std::unique_ptr<WebRTCPeer> (const RoomInfo&)>& createPeer,
+        const std::function<bool (MessageWriter::Buffer*, bool keepalive)>& sendMessage) noexcept;
     ~Session();
 
     bool onConnected() noexcept;
 
-    bool handleMessage(const JsonPtr&) noexcept;
+    // connection is lost, but Janus session can be claimed later
+    // returns false if session can't be resumed
+    bool suspend() noexcept;
+    bool resume() noexcept;
+
+    bool handleMessage(JanusFrame*) noexcept;
+
+    json_int_t janusSession() const noexcept;
+    bool isTransactionPending(TransactionId) const noexcept;
 
 private:
+    bool fastStart() const noexcept;
+    void startHandshake();
+    void finishHandshake();
     void disconnect();
+    bool sendMessage(bool keepalive = false);
+    void sendMessage(MessageType, TransactionId);
     void sendMessage(const JsonPtr&);
     void sendMessage(MessageType, const JsonPtr&);
     void checkTimeout();
@@ -34,31 +57,51 @@ private:
     void sendCreateSession();
     bool handleCreateSessionReply(const JsonPtr&);
 
+    void sendDestroySession();
+
     void sendAttachPlugin();
     bool handleAttachPluginReply(const JsonPtr&);
 
+    void sendListRooms();
+    bool handleListRoomsReply(const JsonPtr&);
+
     void sendJoin();
     bool handleJoinReply(const JsonPtr&);
 
-    void sendPublish(const std::string& sdp);
+    void sendPublish(const std::string& sdp, bool iceRestart = false);
     bool handlePublishReply(const JsonPtr&);
 
-    // void sendJoinAndConfigure(const std::string& sdp);
-    // bool handleJoinAndConfigureReply(const JsonPtr&);
+    void sendJoinAndConfigure(const std::string& sdp);
+    bool handleJoinAndConfigureReply(const JsonPtr&);
 
     void sendUnPublish();
     bool handleUnPublishReply(const JsonPtr&);
 
-    void sendTrickle(unsigned mlineIndex, const std::string& candidate);
+    // sends all pending candidates in one message
+    void sendTrickle();
     bool handleTrickleReply(const JsonPtr&);
 
     void sendListParticipants();
     bool handleListParticipantsReply(const JsonPtr&);
 
-    bool handleEvent(const JsonPtr&);
+    void sendClaim();
+    bool handleClaimReply(const JsonPtr&);
+    // recreates Janus session and stream on the same connection
+    bool restart();
+
+    bool handleEvent(JanusFrame*);
+    bool handleRoomEvent(const JsonPtr&);
+    // starts stream if there is anybody in the room, stops otherwise
+    void updateStreamState();
 
     void streamerPrepared();
     void iceCandidate(unsigned mlineIndex, const std::string& candidate);
+    void startGatherTimeout();
+    void stopGathering();
+    void connectionStateChanged(RestartablePeer::ConnectionState);
+    // recovers media path on the same handle, false if not possible
+    bool restartIce();
+    void stopIceRestart();
     void eos();
 
     void startStream();
@@ -66,20 +109,43 @@ private:
 
 private:
     const Config *const _config;
-    const std::function<std::unique_ptr<WebRTCPeer> ()> _createPeer;
-    const std::function<void (const char*)> _sendMessage;
+    const StreamConfig *const _streamConfig;
+    const std::function<std::unique_ptr<WebRTCPeer> (const RoomInfo&)> _createPeer;
+    // returns false if message was dropped
+    const std::function<bool (MessageWriter::Buffer*, bool keepalive)> _sendMessage;
+
+    MessageWriter _writer;
 
-    int _nextTransaction = 1;
+    TransactionTable _sentMessages;
 
-    std::map<std::string, MessageType> _sentMessages;
+    TimerWheel::Timer _checkTimeoutTimer;
+    TimerWheel::Timer _updateParticipantsTimer;
+    gint64 _lastMessageTime;
 
-    guint _keepaliveTimeout = 0;
-    GTimerPtr _lastMessageTimer;
+    const IcePolicy _icePolicy;
+    std::vector<std::pair<unsigned, std::string>> _pendingCandidates;
+    GSourcePtr _trickleTimeoutPtr;
+    bool _candidatesEnded = false;
+    GSourcePtr _gatherTimeoutPtr;
 
-    guint _updateParticipantsTimeout = 0;
+    bool _online = true;
+
+    bool _handshakeAdmitted = false;
+    GSourcePtr _handshakeRetryTimeoutPtr;
 
     json_int_t _session = 0;
     json_int_t _handleId = 0;
+    bool _joined = false;
+    json_int_t _publisherId = 0;
+    std::set<json_int_t> _participants; // other room participants
+    RoomInfo _room;
 
     std::unique_ptr<WebRTCPeer> _streamerPtr;
+    bool _streamerPrepared = false;
+    bool _offerSent = false;
+    bool _answerReceived = false;
+
+    std::string _iceUfrag; // of last sent offer
+    bool _iceRestarting = false;
+    GSourcePtr _iceRestartTimeoutPtr;
 };
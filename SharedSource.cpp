@@ -0,0 +1,755 @@
+#include "SharedSource.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "SharedSourcePeer.h"
+#include "Log.h"
+
+
+namespace {
+
+enum {
+    TEST_WIDTH = 640,
+    TEST_HEIGHT = 480,
+    TEST_FRAMERATE = 30,
+    KEYFRAME_INTERVAL = 60,
+    RTP_PAYLOAD_TYPE = 96,
+};
+
+const auto Log = ClientLog;
+
+// bitrate is in kbit/s, 0 - encoder default
+std::string Encoder(GstRtStreaming::Videocodec videocodec, unsigned bitrate)
+{
+    switch(videocodec) {
+    case GstRtStreaming::Videocodec::h264:
+        return
+            "x264enc name=encoder tune=zerolatency speed-preset=ultrafast"
+            " key-int-max=" + std::to_string(KEYFRAME_INTERVAL) +
+            (bitrate ? " bitrate=" + std::to_string(bitrate) : std::string()) +
+            " ! video/x-h264,profile=constrained-baseline"
+            " ! rtph264pay config-interval=-1"
+            " pt=" + std::to_string(RTP_PAYLOAD_TYPE);
+    case GstRtStreaming::Videocodec::vp8:
+    default:
+        return
+            "vp8enc name=encoder deadline=1"
+            " keyframe-max-dist=" + std::to_string(KEYFRAME_INTERVAL) +
+            (bitrate ? " target-bitrate=" + std::to_string(bitrate * 1000) : std::string()) +
+            " ! rtpvp8pay"
+            " pt=" + std::to_string(RTP_PAYLOAD_TYPE);
+    }
+}
+
+// initial bitrate of adaptive encoder
+unsigned StartBitrate(const StreamerConfig& config)
+{
+    return
+        config.maxBitrate > 0 ?
+            BitrateController(config.minBitrate, config.maxBitrate).bitrate() :
+            0;
+}
+
+std::string TestPipeline(const StreamerConfig& config, GstRtStreaming::Videocodec videocodec)
+{
+    std::string pipeline = "videotestsrc is-live=true";
+    if(!config.source.empty())
+        pipeline += " pattern=" + config.source;
+
+    pipeline +=
+        " ! video/x-raw"
+        ",width=" + std::to_string(TEST_WIDTH) +
+        ",height=" + std::to_string(TEST_HEIGHT) +
+        ",framerate=" + std::to_string(TEST_FRAMERATE) + "/1"
+        " ! videoconvert ! " +
+        CpuGovernor::Ladder +
+        Encoder(videocodec, StartBitrate(config));
+
+    return pipeline;
+}
+
+}
+
+SharedSource::SharedSource(
+    const std::string& name,
+    const StreamerConfig& config,
+    IceConfig::TransportPolicy iceTransportPolicy) noexcept :
+    _name(name), _config(config), _iceTransportPolicy(iceTransportPolicy),
+    _testVideocodec(config.videocodec)
+{
+}
+
+struct SharedSource::BranchRemoval
+{
+    std::mutex mutex;
+    bool cancelled; // source is stopping and will finish removal itself
+    bool done;
+
+    // tee owns it's request pad until it's released,
+    // ref from here would make "tee -> pad -> probe -> pad" cycle
+    GstPad* teePad;
+    GstElementPtr queuePtr;
+    GstElementPtr transcoderPtr;
+    GstElementPtr webrtcbinPtr;
+};
+
+SharedSource::~SharedSource()
+{
+    stop();
+}
+
+const std::string& SharedSource::name() const noexcept
+{
+    return _name;
+}
+
+std::unique_ptr<WebRTCPeer> SharedSource::createPeer(const RoomInfo& room) noexcept
+{
+    // test source can encode whatever room allows
+    // instead of transcoding for every peer
+    if(_config.type == StreamerConfig::Type::Test && _peers.empty()) {
+        const GstRtStreaming::Videocodec videocodec =
+            ChooseVideocodec(_config.videocodec, room.videocodecs);
+        if(videocodec != _testVideocodec) {
+            Log()->info(
+                "Shared source \"{}\" switches to {} allowed by room",
+                _name, VideocodecName(videocodec));
+
+            // could be in standby
+            stop();
+            _testVideocodec = videocodec;
+        }
+    }
+
+    return std::make_unique<SharedSourcePeer>(this, room);
+}
+
+GstElement* SharedSource::pipeline() const noexcept
+{
+    return _pipelinePtr.get();
+}
+
+GstElement* SharedSource::tee() const noexcept
+{
+    return _teePtr.get();
+}
+
+bool SharedSource::isReady() const noexcept
+{
+    return _ready;
+}
+
+std::shared_ptr<GopCache> SharedSource::gopCache() const noexcept
+{
+    return _gopCachePtr;
+}
+
+bool SharedSource::videocodec(GstRtStreaming::Videocodec* videocodec) const noexcept
+{
+    if(!_videocodecKnown)
+        return false;
+
+    *videocodec = _videocodec;
+
+    return true;
+}
+
+GstElement* SharedSource::encoder() const noexcept
+{
+    return _encoderPtr.get();
+}
+
+const StreamerConfig& SharedSource::config() const noexcept
+{
+    return _config;
+}
+
+IceConfig::TransportPolicy SharedSource::iceTransportPolicy() const noexcept
+{
+    return _iceTransportPolicy;
+}
+
+std::string SharedSource::transcoder(
+    GstRtStreaming::Videocodec target,
+    unsigned bitrate) const noexcept
+{
+    const char* depay =
+        _videocodec == GstRtStreaming::Videocodec::h264 ?
+            "rtph264depay" :
+            "rtpvp8depay";
+
+    return
+        std::string(depay) +
+        " ! decodebin ! videoconvert ! " +
+        CpuGovernor::Ladder +
+        Encoder(target, bitrate);
+}
+
+void SharedSource::SetEncoderBitrate(GstElement* encoder, unsigned bitrate)
+{
+    GObjectClass* encoderClass = G_OBJECT_GET_CLASS(encoder);
+    if(g_object_class_find_property(encoderClass, "target-bitrate")) {
+        // vp8enc, vp9enc: bit/s
+        g_object_set(encoder, "target-bitrate", static_cast<gint>(bitrate * 1000), nullptr);
+    } else if(g_object_class_find_property(encoderClass, "bitrate")) {
+        // x264enc: kbit/s
+        g_object_set(encoder, "bitrate", static_cast<guint>(bitrate), nullptr);
+    }
+}
+
+// shared encoder can't go faster than the slowest peer
+void SharedSource::updateBitrate()
+{
+    if(!_encoderPtr || _config.maxBitrate == 0)
+        return;
+
+    unsigned bitrate = 0;
+    for(const auto& pair: _peers) {
+        const unsigned peerBitrate = pair.second->sourceBitrate();
+        if(peerBitrate > 0 && (bitrate == 0 || peerBitrate < bitrate))
+            bitrate = peerBitrate;
+    }
+
+    if(bitrate == 0 || bitrate == _bitrate)
+        return;
+
+    Log()->debug("Shared source \"{}\" bitrate: {} kbit/s", _name, bitrate);
+
+    _bitrate = bitrate;
+    SetEncoderBitrate(_encoderPtr.get(), bitrate);
+}
+
+unsigned SharedSource::attach(SharedSourcePeer* peer) noexcept
+{
+    if(_standbyTimeoutPtr)
+        leaveStandby();
+
+    if(!_pipelinePtr && !start()) {
+        stop();
+        return 0;
+    }
+
+    const unsigned peerId = _nextPeerId++;
+    _peers.emplace(peerId, peer);
+
+    Log()->debug(
+        "Peer #{} attached to shared source \"{}\". Peers count: {}",
+        peerId, _name, _peers.size());
+
+    return peerId;
+}
+
+void SharedSource::detach(unsigned peerId) noexcept
+{
+    _peers.erase(peerId);
+
+    Log()->debug(
+        "Peer #{} detached from shared source \"{}\". Peers count: {}",
+        peerId, _name, _peers.size());
+
+    if(!_peers.empty()) {
+        // the slowest peer could be gone
+        updateBitrate();
+        return;
+    }
+
+    if(_config.standbyTimeout > 0 && _pipelinePtr)
+        enterStandby();
+    else
+        stop();
+}
+
+void SharedSource::removeBranch(
+    GstPad* teePad,
+    GstElementPtr&& queuePtr,
+    GstElementPtr&& transcoderPtr,
+    GstElementPtr&& webrtcbinPtr) noexcept
+{
+    std::shared_ptr<BranchRemoval> removalPtr = std::make_shared<BranchRemoval>();
+    removalPtr->cancelled = false;
+    removalPtr->done = false;
+    removalPtr->teePad = teePad;
+    removalPtr->queuePtr = std::move(queuePtr);
+    removalPtr->transcoderPtr = std::move(transcoderPtr);
+    removalPtr->webrtcbinPtr = std::move(webrtcbinPtr);
+
+    if(!_pipelinePtr || !teePad || !gst_pad_is_linked(teePad)) {
+        std::lock_guard<std::mutex> lock(removalPtr->mutex);
+        TearDownBranch(removalPtr.get());
+        return;
+    }
+
+    _branchRemovals.erase(
+        std::remove_if(
+            _branchRemovals.begin(),
+            _branchRemovals.end(),
+            [] (const std::shared_ptr<BranchRemoval>& pendingPtr) {
+                std::lock_guard<std::mutex> lock(pendingPtr->mutex);
+                return pendingPtr->done;
+            }),
+        _branchRemovals.end());
+    _branchRemovals.push_back(removalPtr);
+
+    // runs on streaming thread (or right here if pad is idle already)
+    gst_pad_add_probe(
+        teePad,
+        GST_PAD_PROBE_TYPE_IDLE,
+        [] (GstPad*, GstPadProbeInfo*, gpointer userData) -> GstPadProbeReturn {
+            BranchRemoval* removal =
+                static_cast<std::shared_ptr<BranchRemoval>*>(userData)->get();
+
+            std::lock_guard<std::mutex> lock(removal->mutex);
+            if(!removal->cancelled)
+                TearDownBranch(removal);
+
+            return GST_PAD_PROBE_REMOVE;
+        },
+        new std::shared_ptr<BranchRemoval>(removalPtr),
+        [] (gpointer userData) {
+            delete static_cast<std::shared_ptr<BranchRemoval>*>(userData);
+        });
+}
+
+void SharedSource::TearDownBranch(BranchRemoval* removal)
+{
+    if(removal->done)
+        return;
+
+    removal->done = true;
+
+    if(GstPad* teePad = removal->teePad) {
+        if(GstElement* queue = removal->queuePtr.get()) {
+            GstPadPtr queueSinkPadPtr(gst_element_get_static_pad(queue, "sink"));
+            if(gst_pad_is_linked(teePad))
+                gst_pad_unlink(teePad, queueSinkPadPtr.get());
+        }
+
+        GstElementPtr teePtr(gst_pad_get_parent_element(teePad));
+        if(teePtr)
+            gst_element_release_request_pad(teePtr.get(), teePad);
+        removal->teePad = nullptr;
+    }
+
+    for(GstElementPtr* elementPtr: {
+        &removal->webrtcbinPtr,
+        &removal->transcoderPtr,
+        &removal->queuePtr })
+    {
+        GstElement* element = elementPtr->get();
+        if(!element)
+            continue;
+
+        gst_element_set_state(element, GST_STATE_NULL);
+
+        GstObject* parent = gst_object_get_parent(GST_OBJECT(element));
+        if(parent) {
+            gst_bin_remove(GST_BIN(parent), element);
+            gst_object_unref(parent);
+        }
+
+        elementPtr->reset();
+    }
+}
+
+// pipeline keeps running (with "tee" discarding data),
+// so next peer doesn't wait for source (re)connection and negotiation
+void SharedSource::enterStandby()
+{
+    Log()->info(
+        "Shared source \"{}\" has no peers. Keeping it warm for {} seconds...",
+        _name, _config.standbyTimeout);
+
+    // nothing to keep warm for local test source except encoder
+    if(_config.type == StreamerConfig::Type::Test)
+        gst_element_set_state(_pipelinePtr.get(), GST_STATE_PAUSED);
+
+    _standbyTimeoutPtr.reset(g_timeout_source_new_seconds(_config.standbyTimeout));
+    g_source_set_callback(
+        _standbyTimeoutPtr.get(),
+        [] (gpointer userData) -> gboolean {
+            SharedSource* self = static_cast<SharedSource*>(userData);
+            self->_standbyTimeoutPtr.reset();
+            self->stop();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(_standbyTimeoutPtr.get(), g_main_context_get_thread_default());
+}
+
+void SharedSource::leaveStandby()
+{
+    g_source_destroy(_standbyTimeoutPtr.get());
+    _standbyTimeoutPtr.reset();
+
+    if(!_pipelinePtr)
+        return;
+
+    Log()->info("Resuming shared source \"{}\" from standby...", _name);
+
+    if(_config.type == StreamerConfig::Type::Test)
+        gst_element_set_state(_pipelinePtr.get(), GST_STATE_PLAYING);
+}
+
+bool SharedSource::start()
+{
+    Log()->info("Starting shared source \"{}\"...", _name);
+
+    GstElementPtr pipelinePtr;
+    switch(_config.type) {
+    case StreamerConfig::Type::Test:
+    case StreamerConfig::Type::Pipeline: {
+        const std::string pipelineDesc =
+            (_config.type == StreamerConfig::Type::Test ?
+                TestPipeline(_config, _testVideocodec) :
+                _config.source) +
+            " ! tee name=tee allow-not-linked=true";
+
+        GError* error = nullptr;
+        pipelinePtr.reset(gst_parse_launch(pipelineDesc.c_str(), &error));
+        GErrorPtr errorPtr(error);
+        if(error) {
+            Log()->error(
+                "Fail create pipeline for shared source \"{}\": {}",
+                _name, error->message);
+            return false;
+        }
+        break;
+    }
+    case StreamerConfig::Type::ReStreamer: {
+        pipelinePtr.reset(gst_pipeline_new(nullptr));
+        GstElement* rtspsrc = gst_element_factory_make("rtspsrc", nullptr);
+        GstElement* tee = gst_element_factory_make("tee", "tee");
+        if(!rtspsrc || !tee) {
+            if(rtspsrc) gst_object_unref(rtspsrc);
+            if(tee) gst_object_unref(tee);
+            Log()->error("Fail create elements for shared source \"{}\"", _name);
+            return false;
+        }
+
+        g_object_set(rtspsrc, "location", _config.source.c_str(), nullptr);
+        g_object_set(tee, "allow-not-linked", TRUE, nullptr);
+
+        g_signal_connect(rtspsrc, "pad-added", G_CALLBACK(OnRtspPadAdded), this);
+
+        gst_bin_add_many(GST_BIN(pipelinePtr.get()), rtspsrc, tee, nullptr);
+        break;
+    }
+    }
+
+    if(!pipelinePtr)
+        return false;
+
+    GstElement* pipeline = pipelinePtr.get();
+
+    _teePtr.reset(gst_bin_get_by_name(GST_BIN(pipeline), "tee"));
+    if(!_teePtr) {
+        Log()->error("Missing \"tee\" in shared source \"{}\" pipeline", _name);
+        return false;
+    }
+
+    // "pipeline" source can name it's encoder "encoder"
+    // to get adaptive bitrate and CPU overload protection
+    if(_config.type != StreamerConfig::Type::ReStreamer) {
+        GstElementPtr encoderPtr(gst_bin_get_by_name(GST_BIN(pipeline), "encoder"));
+        if(encoderPtr)
+            _governorClient.attach(pipeline, _config.priority);
+
+        if(_config.maxBitrate > 0) {
+            _encoderPtr = std::move(encoderPtr);
+            _bitrate = StartBitrate(_config);
+        }
+    }
+
+    GstPadPtr teeSinkPadPtr(gst_element_get_static_pad(_teePtr.get(), "sink"));
+    gst_pad_add_probe(
+        teeSinkPadPtr.get(),
+        GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer) -> GstPadProbeReturn {
+            GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+            if(GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+                return GST_PAD_PROBE_OK;
+
+            GstCaps* caps = nullptr;
+            gst_event_parse_caps(event, &caps);
+            const GstStructure* capsStructure =
+                caps && !gst_caps_is_empty(caps) ?
+                    gst_caps_get_structure(caps, 0) :
+                    nullptr;
+            const gchar* encoding =
+                capsStructure ?
+                    gst_structure_get_string(capsStructure, "encoding-name") :
+                    nullptr;
+
+            GstStructure* structure = gst_structure_new_empty("source-ready");
+            if(encoding)
+                gst_structure_set(structure, "encoding-name", G_TYPE_STRING, encoding, nullptr);
+
+            GstElement* tee = GST_ELEMENT(gst_pad_get_parent(pad));
+            gst_element_post_message(
+                tee,
+                gst_message_new_application(GST_OBJECT(tee), structure));
+            gst_object_unref(tee);
+
+            return GST_PAD_PROBE_REMOVE;
+        }, nullptr, nullptr);
+
+    if(_config.gopCache) {
+        _gopCachePtr = std::make_shared<GopCache>();
+
+        // every packet goes through cache before it reaches any peer branch
+        gst_pad_add_probe(
+            teeSinkPadPtr.get(),
+            static_cast<GstPadProbeType>(
+                GST_PAD_PROBE_TYPE_BUFFER |
+                GST_PAD_PROBE_TYPE_BUFFER_LIST |
+                GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+            [] (GstPad*, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+                GopCache* cache = static_cast<std::shared_ptr<GopCache>*>(userData)->get();
+                if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+                    cache->push(GST_PAD_PROBE_INFO_BUFFER(info));
+                } else if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+                    gst_buffer_list_foreach(
+                        GST_PAD_PROBE_INFO_BUFFER_LIST(info),
+                        [] (GstBuffer** buffer, guint, gpointer userData) -> gboolean {
+                            static_cast<GopCache*>(userData)->push(*buffer);
+                            return TRUE;
+                        }, cache);
+                } else {
+                    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+                    if(GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+                        GstCaps* caps = nullptr;
+                        gst_event_parse_caps(event, &caps);
+                        cache->setCaps(caps);
+                    } else if(GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP) {
+                        cache->clear();
+                    }
+                }
+                return GST_PAD_PROBE_OK;
+            },
+            new std::shared_ptr<GopCache>(_gopCachePtr),
+            [] (gpointer userData) {
+                delete static_cast<std::shared_ptr<GopCache>*>(userData);
+            });
+    }
+
+    // attached to thread default main context
+    GstBusPtr busPtr(gst_element_get_bus(pipeline));
+    gst_bus_add_watch(
+        busPtr.get(),
+        [] (GstBus*, GstMessage* message, gpointer userData) -> gboolean {
+            return static_cast<SharedSource*>(userData)->onBusMessage(message);
+        }, this);
+
+    _pipelinePtr = std::move(pipelinePtr);
+
+    if(GST_STATE_CHANGE_FAILURE == gst_element_set_state(pipeline, GST_STATE_PLAYING)) {
+        Log()->error("Fail start shared source \"{}\"", _name);
+        return false;
+    }
+
+    return true;
+}
+
+void SharedSource::stop()
+{
+    _ready = false;
+    _videocodecKnown = false;
+
+    if(_standbyTimeoutPtr) {
+        g_source_destroy(_standbyTimeoutPtr.get());
+        _standbyTimeoutPtr.reset();
+    }
+
+    std::vector<std::shared_ptr<BranchRemoval>> branchRemovals;
+    branchRemovals.swap(_branchRemovals);
+
+    // branches can't be removed from streaming thread
+    // while pipeline is changing state, so removal is finished here
+    for(const std::shared_ptr<BranchRemoval>& removalPtr: branchRemovals) {
+        std::lock_guard<std::mutex> lock(removalPtr->mutex);
+        removalPtr->cancelled = true;
+    }
+
+    if(_pipelinePtr) {
+        Log()->info("Stopping shared source \"{}\"...", _name);
+
+        GstBusPtr busPtr(gst_element_get_bus(_pipelinePtr.get()));
+        gst_bus_remove_watch(busPtr.get());
+
+        gst_element_set_state(_pipelinePtr.get(), GST_STATE_NULL);
+    }
+
+    for(const std::shared_ptr<BranchRemoval>& removalPtr: branchRemovals) {
+        std::lock_guard<std::mutex> lock(removalPtr->mutex);
+        TearDownBranch(removalPtr.get());
+    }
+
+    _governorClient.detach();
+    _gopCachePtr.reset();
+    _encoderPtr.reset();
+    _bitrate = 0;
+    _teePtr.reset();
+    _pipelinePtr.reset();
+}
+
+void SharedSource::OnRtspPadAdded(
+    GstElement* /*rtspsrc*/,
+    GstPad* pad,
+    gpointer userData)
+{
+    static_cast<SharedSource*>(userData)->onRtspPadAdded(pad);
+}
+
+void SharedSource::onRtspPadAdded(GstPad* pad)
+{
+    GstCapsPtr capsPtr(gst_pad_query_caps(pad, nullptr));
+    if(!capsPtr || gst_caps_is_empty(capsPtr.get()))
+        return;
+
+    const GstStructure* structure = gst_caps_get_structure(capsPtr.get(), 0);
+    const gchar* media = gst_structure_get_string(structure, "media");
+    const gchar* encoding = gst_structure_get_string(structure, "encoding-name");
+    if(!media || !encoding || 0 != g_strcmp0(media, "video"))
+        return;
+
+    const std::string payloadType = std::to_string(RTP_PAYLOAD_TYPE);
+    std::string binDesc;
+    if(0 == g_ascii_strcasecmp(encoding, "H264"))
+        binDesc = "rtph264depay ! rtph264pay config-interval=-1 pt=" + payloadType;
+    else if(0 == g_ascii_strcasecmp(encoding, "VP8"))
+        binDesc = "rtpvp8depay ! rtpvp8pay pt=" + payloadType;
+    else {
+        Log()->warn(
+            "Shared source \"{}\" has unsupported encoding \"{}\"",
+            _name, encoding);
+        return;
+    }
+
+    GstPadPtr teeSinkPadPtr(gst_element_get_static_pad(_teePtr.get(), "sink"));
+    if(gst_pad_is_linked(teeSinkPadPtr.get()))
+        return;
+
+    GError* error = nullptr;
+    GstElement* bin = gst_parse_bin_from_description(binDesc.c_str(), TRUE, &error);
+    GErrorPtr errorPtr(error);
+    if(error) {
+        Log()->error(
+            "Fail create depayloader for shared source \"{}\": {}",
+            _name, error->message);
+        return;
+    }
+
+    gst_bin_add(GST_BIN(_pipelinePtr.get()), bin);
+
+    GstPadPtr binSinkPadPtr(gst_element_get_static_pad(bin, "sink"));
+    GstPadPtr binSrcPadPtr(gst_element_get_static_pad(bin, "src"));
+    if(GST_PAD_LINK_OK != gst_pad_link(pad, binSinkPadPtr.get()) ||
+       GST_PAD_LINK_OK != gst_pad_link(binSrcPadPtr.get(), teeSinkPadPtr.get()))
+    {
+        Log()->error("Fail link depayloader for shared source \"{}\"", _name);
+        return;
+    }
+
+    gst_element_sync_state_with_parent(bin);
+}
+
+bool SharedSource::onBusMessage(GstMessage* message)
+{
+    switch(GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_APPLICATION:
+        onApplicationMessage(gst_message_get_structure(message));
+        break;
+    case GST_MESSAGE_EOS:
+        onEos(false);
+        break;
+    case GST_MESSAGE_ERROR: {
+        GError* error = nullptr;
+        gst_message_parse_error(message, &error, nullptr);
+        GErrorPtr errorPtr(error);
+        Log()->error(
+            "Shared source \"{}\" failed: {}",
+            _name, error ? error->message : "unknown error");
+        onEos(true);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return TRUE;
+}
+
+void SharedSource::onApplicationMessage(const GstStructure* structure)
+{
+    if(gst_structure_has_name(structure, "source-ready")) {
+        onReady(gst_structure_get_string(structure, "encoding-name"));
+        return;
+    }
+
+    guint peerId = 0;
+    if(!gst_structure_get_uint(structure, "peer-id", &peerId))
+        return;
+
+    auto it = _peers.find(peerId);
+    if(it == _peers.end())
+        return;
+
+    SharedSourcePeer* peer = it->second;
+
+    if(gst_structure_has_name(structure, "peer-prepared")) {
+        const gchar* sdp = gst_structure_get_string(structure, "sdp");
+        peer->onPrepared(sdp ? sdp : "");
+    } else if(gst_structure_has_name(structure, "peer-stats")) {
+        gdouble fractionLost = 0;
+        gdouble roundTripTime = -1;
+        gst_structure_get_double(structure, "fraction-lost", &fractionLost);
+        gst_structure_get_double(structure, "round-trip-time", &roundTripTime);
+        peer->onStats(fractionLost, roundTripTime);
+    } else if(gst_structure_has_name(structure, "peer-ice-candidate")) {
+        guint mlineIndex = 0;
+        gst_structure_get_uint(structure, "mline-index", &mlineIndex);
+        const gchar* candidate = gst_structure_get_string(structure, "candidate");
+        if(candidate)
+            peer->onIceCandidate(mlineIndex, candidate);
+    } else if(gst_structure_has_name(structure, "peer-connection-state")) {
+        gint state = 0;
+        if(gst_structure_get_int(structure, "state", &state))
+            peer->onConnectionState(static_cast<RestartablePeer::ConnectionState>(state));
+    }
+}
+
+void SharedSource::onReady(const gchar* encoding)
+{
+    if(_ready)
+        return;
+
+    Log()->info(
+        "Shared source \"{}\" is ready ({})",
+        _name, encoding ? encoding : "unknown encoding");
+
+    _ready = true;
+    _videocodecKnown = ParseVideocodec(encoding, &_videocodec);
+
+    std::vector<SharedSourcePeer*> peers;
+    for(const auto& pair: _peers)
+        peers.push_back(pair.second);
+
+    for(SharedSourcePeer* peer: peers)
+        peer->onSourceReady();
+}
+
+void SharedSource::onEos(bool error)
+{
+    if(!error)
+        Log()->info("Shared source \"{}\" reached end of stream", _name);
+
+    std::vector<SharedSourcePeer*> peers;
+    for(const auto& pair: _peers)
+        peers.push_back(pair.second);
+
+    stop();
+
+    for(SharedSourcePeer* peer: peers)
+        peer->onSourceEos();
+}
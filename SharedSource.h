@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <map>
+#include <vector>
+
+#include <gst/gst.h>
+
+#include "CxxPtr/GstPtr.h"
+#include "CxxPtr/GlibPtr.h"
+
+#include "Config.h"
+#include "GopCache.h"
+#include "RoomInfo.h"
+#include "BitrateController.h"
+#include "CpuGovernor.h"
+#include "RtStreaming/WebRTCPeer.h"
+
+
+class SharedSourcePeer;
+
+// Ingests (or encodes) source once
+// and feeds resulting RTP stream to any number of WebRTC peers
+class SharedSource
+{
+public:
+    SharedSource(
+        const std::string& name,
+        const StreamerConfig&,
+        IceConfig::TransportPolicy = IceConfig::TransportPolicy::All) noexcept;
+    ~SharedSource();
+
+    const std::string& name() const noexcept;
+
+    // source is transcoded for peer only if room doesn't allow source codec
+    std::unique_ptr<WebRTCPeer> createPeer(const RoomInfo& = RoomInfo()) noexcept;
+
+private:
+    friend class SharedSourcePeer;
+
+    GstElement* pipeline() const noexcept;
+    GstElement* tee() const noexcept;
+    bool isReady() const noexcept;
+    std::shared_ptr<GopCache> gopCache() const noexcept;
+    bool videocodec(GstRtStreaming::Videocodec*) const noexcept;
+    // "depay ! decode ! encode ! pay" bin description
+    std::string transcoder(GstRtStreaming::Videocodec target, unsigned bitrate) const noexcept;
+    // adaptive encoder of source, nullptr if source is not encoded or bitrate is fixed
+    GstElement* encoder() const noexcept;
+    const StreamerConfig& config() const noexcept;
+    IceConfig::TransportPolicy iceTransportPolicy() const noexcept;
+
+    // kbit/s
+    static void SetEncoderBitrate(GstElement* encoder, unsigned bitrate);
+    void updateBitrate();
+
+    unsigned attach(SharedSourcePeer*) noexcept;
+    void detach(unsigned peerId) noexcept;
+
+    // unlinks peer branch from tee once tee pad is idle
+    // (or immediately if source is not running) and destroys it
+    void removeBranch(
+        GstPad* teePad,
+        GstElementPtr&& queuePtr,
+        GstElementPtr&& transcoderPtr,
+        GstElementPtr&& webrtcbinPtr) noexcept;
+
+private:
+    struct BranchRemoval;
+    // should be called with BranchRemoval::mutex locked
+    static void TearDownBranch(BranchRemoval*);
+
+    bool start();
+    void stop();
+
+    void enterStandby();
+    void leaveStandby();
+
+    bool onBusMessage(GstMessage*);
+    void onApplicationMessage(const GstStructure*);
+    void onReady(const gchar* encoding);
+    void onEos(bool error);
+
+    static void OnRtspPadAdded(GstElement* rtspsrc, GstPad*, gpointer userData);
+    void onRtspPadAdded(GstPad*);
+
+private:
+    const std::string _name;
+    const StreamerConfig _config;
+    const IceConfig::TransportPolicy _iceTransportPolicy;
+
+    // encoded by test source, follows room allowed codecs
+    GstRtStreaming::Videocodec _testVideocodec;
+
+    GstElementPtr _pipelinePtr;
+    GstElementPtr _teePtr;
+    bool _ready = false;
+    bool _videocodecKnown = false;
+    GstRtStreaming::Videocodec _videocodec;
+
+    GstElementPtr _encoderPtr;
+    unsigned _bitrate = 0; // kbit/s
+
+    CpuGovernor::Client _governorClient;
+
+    std::shared_ptr<GopCache> _gopCachePtr;
+
+    GSourcePtr _standbyTimeoutPtr;
+
+    std::vector<std::shared_ptr<BranchRemoval>> _branchRemovals;
+
+    unsigned _nextPeerId = 1;
+    std::map<unsigned, SharedSourcePeer*> _peers;
+};
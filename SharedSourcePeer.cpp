@@ -0,0 +1,1059 @@
+#include "SharedSourcePeer.h"
+
+#include <algorithm>
+#include <atomic>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+#include <gst/sdp/sdp.h>
+
+#include "CxxPtr/GlibPtr.h"
+
+#include "SharedSource.h"
+#include "GopSplicer.h"
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ClientLog;
+
+enum {
+    STATS_INTERVAL = 1000, // ms
+    PACER_STATS_INTERVAL = 10, // seconds
+    RECOVERY_STATS_INTERVAL = 10, // seconds
+};
+
+const gchar* const PeerIdKey = "shared-source-peer-id";
+
+GstElement* MakeElement(const gchar* factory)
+{
+    GstElement* element = gst_element_factory_make(factory, nullptr);
+    if(!element)
+        return nullptr;
+
+    return GST_ELEMENT(gst_object_ref_sink(element));
+}
+
+void PostPeerMessage(GstElement* webrtcbin, GstStructure* structure)
+{
+    const guint peerId =
+        GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(webrtcbin), PeerIdKey));
+    gst_structure_set(structure, "peer-id", G_TYPE_UINT, peerId, nullptr);
+
+    gst_element_post_message(
+        webrtcbin,
+        gst_message_new_application(GST_OBJECT(webrtcbin), structure));
+}
+
+bool IsMadeBy(GstElement* element, const gchar* factoryName)
+{
+    GstElementFactory* factory = gst_element_get_factory(element);
+    return factory &&
+        0 == g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), factoryName);
+}
+
+// sums guint property of all elements made by factory inside bin (recursively)
+guint SumProperty(GstElement* bin, const gchar* factoryName, const gchar* property)
+{
+    guint sum = 0;
+
+    GstIterator* iterator = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+    bool done = false;
+    while(!done) {
+        switch(gst_iterator_next(iterator, &item)) {
+        case GST_ITERATOR_OK: {
+            GstElement* element = GST_ELEMENT(g_value_get_object(&item));
+            if(IsMadeBy(element, factoryName)) {
+                guint value = 0;
+                g_object_get(element, property, &value, nullptr);
+                sum += value;
+            }
+            g_value_reset(&item);
+            break;
+        }
+        case GST_ITERATOR_RESYNC:
+            sum = 0;
+            gst_iterator_resync(iterator);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    return sum;
+}
+
+// sets guint property of all elements made by factory inside bin (recursively)
+void SetProperty(GstElement* bin, const gchar* factoryName, const gchar* property, guint value)
+{
+    GstIterator* iterator = gst_bin_iterate_recurse(GST_BIN(bin));
+    GValue item = G_VALUE_INIT;
+    bool done = false;
+    while(!done) {
+        switch(gst_iterator_next(iterator, &item)) {
+        case GST_ITERATOR_OK: {
+            GstElement* element = GST_ELEMENT(g_value_get_object(&item));
+            if(IsMadeBy(element, factoryName))
+                g_object_set(element, property, value, nullptr);
+            g_value_reset(&item);
+            break;
+        }
+        case GST_ITERATOR_RESYNC:
+            gst_iterator_resync(iterator);
+            break;
+        default:
+            done = true;
+            break;
+        }
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+}
+
+// the same as gst_video_event_new_upstream_force_key_unit(),
+// but without dependency on gstreamer-video
+GstEvent* NewForceKeyUnitEvent()
+{
+    return gst_event_new_custom(
+        GST_EVENT_CUSTOM_UPSTREAM,
+        gst_structure_new(
+            "GstForceKeyUnit",
+            "all-headers", G_TYPE_BOOLEAN, TRUE,
+            nullptr));
+}
+
+struct GopSplice
+{
+    GopSplice(
+        const std::shared_ptr<GopCache>& cachePtr,
+        GstElement* webrtcbin,
+        GstElement* queue) :
+        splicer(cachePtr),
+        webrtcbinPtr(GST_ELEMENT(gst_object_ref(webrtcbin))),
+        connected(false), splicing(false), windowOpen(false)
+    {
+        g_object_get(queue,
+            "max-size-buffers", &maxSizeBuffers,
+            "max-size-bytes", &maxSizeBytes,
+            "max-size-time", &maxSizeTime,
+            nullptr);
+    }
+
+    GopSplicer splicer;
+    GstElementPtr webrtcbinPtr;
+    std::atomic<bool> connected;
+    bool splicing;
+
+    // queue is unbounded while spliced GOP is in it,
+    // otherwise leaky queue would drop keyframe first
+    bool windowOpen;
+    guint maxSizeBuffers;
+    guint maxSizeBytes;
+    guint64 maxSizeTime;
+};
+
+void OpenSpliceWindow(GstElement* queue, GopSplice* splice)
+{
+    splice->windowOpen = true;
+    g_object_set(queue,
+        "max-size-buffers", 0u,
+        "max-size-bytes", 0u,
+        "max-size-time", G_GUINT64_CONSTANT(0),
+        nullptr);
+}
+
+void CloseSpliceWindowIfDrained(GstElement* queue, GopSplice* splice)
+{
+    guint buffers = 0;
+    guint bytes = 0;
+    guint64 time = 0;
+    g_object_get(queue,
+        "current-level-buffers", &buffers,
+        "current-level-bytes", &bytes,
+        "current-level-time", &time,
+        nullptr);
+
+    if((splice->maxSizeBuffers && buffers >= splice->maxSizeBuffers) ||
+       (splice->maxSizeBytes && bytes >= splice->maxSizeBytes) ||
+       (splice->maxSizeTime && time >= splice->maxSizeTime))
+    {
+        return;
+    }
+
+    splice->windowOpen = false;
+    g_object_set(queue,
+        "max-size-buffers", splice->maxSizeBuffers,
+        "max-size-bytes", splice->maxSizeBytes,
+        "max-size-time", splice->maxSizeTime,
+        nullptr);
+}
+
+// Drops live packets until peer is connected, then sends cached GOP instead of current packet(s).
+// Cache always ends with current packet(s) (tee sink is probed first).
+// Keyframe requests of connected peer are served from cache the same way
+// (instead of forcing keyframe for all peers, or not getting it at all from RTSP source).
+GstPadProbeReturn SpliceGop(GstPad* queueSinkPad, GstPadProbeInfo* info, gpointer userData)
+{
+    GopSplice* splice = static_cast<GopSplice*>(userData);
+
+    // runs on webrtcbin thread
+    if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_UPSTREAM) {
+        GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+        if(GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_UPSTREAM ||
+           !gst_event_has_name(event, "GstForceKeyUnit") ||
+           !splice->connected ||
+           !splice->splicer.canSplice())
+        {
+            return GST_PAD_PROBE_OK;
+        }
+
+        splice->splicer.requestSplice();
+        return GST_PAD_PROBE_DROP;
+    }
+
+    if(splice->splicing)
+        return GST_PAD_PROBE_OK;
+
+    if(!splice->connected) {
+        GstWebRTCPeerConnectionState state = GST_WEBRTC_PEER_CONNECTION_STATE_NEW;
+        g_object_get(splice->webrtcbinPtr.get(), "connection-state", &state, nullptr);
+        if(state != GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED)
+            return GST_PAD_PROBE_DROP;
+
+        splice->connected = true;
+        splice->splicer.requestSplice();
+    }
+
+    GstElementPtr queuePtr(gst_pad_get_parent_element(queueSinkPad));
+    if(!queuePtr)
+        return GST_PAD_PROBE_OK;
+
+    if(splice->windowOpen)
+        CloseSpliceWindowIfDrained(queuePtr.get(), splice);
+
+    if(GstBufferList* gop = splice->splicer.splice()) {
+        OpenSpliceWindow(queuePtr.get(), splice);
+
+        splice->splicing = true;
+        gst_pad_chain_list(queueSinkPad, gop);
+        splice->splicing = false;
+
+        return GST_PAD_PROBE_DROP;
+    }
+
+    bool keep;
+    if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        keep = splice->splicer.rewrite(&buffer);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    } else {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        keep = splice->splicer.rewrite(&list);
+        GST_PAD_PROBE_INFO_DATA(info) = list;
+    }
+
+    return keep ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+struct Pacing
+{
+    std::shared_ptr<Pacer> pacerPtr;
+    bool pushing;
+};
+
+void WaitUntil(gint64 time)
+{
+    const gint64 delay = time - g_get_monotonic_time();
+    if(delay > 0)
+        g_usleep(delay);
+}
+
+// runs on queue streaming thread, so only this peer is delayed
+GstPadProbeReturn PacePackets(GstPad* srcPad, GstPadProbeInfo* info, gpointer userData)
+{
+    Pacing* pacing = static_cast<Pacing*>(userData);
+    if(pacing->pushing)
+        return GST_PAD_PROBE_OK;
+
+    const gint64 arrivalTime = g_get_monotonic_time();
+    Pacer* pacer = pacing->pacerPtr.get();
+
+    if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        WaitUntil(arrivalTime + pacer->schedule(gst_buffer_get_size(buffer), arrivalTime));
+        return GST_PAD_PROBE_OK;
+    }
+
+    // payloaders push whole frame as single list, so it's split to pace every packet
+    GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    const guint length = gst_buffer_list_length(list);
+
+    GstFlowReturn ret = GST_FLOW_OK;
+    pacing->pushing = true;
+    for(guint i = 0; i < length && GST_FLOW_OK == ret; ++i) {
+        GstBuffer* buffer = gst_buffer_list_get(list, i);
+        WaitUntil(arrivalTime + pacer->schedule(gst_buffer_get_size(buffer), arrivalTime));
+        ret = gst_pad_push(srcPad, gst_buffer_ref(buffer));
+    }
+    pacing->pushing = false;
+
+    // upstream has to see downstream flow result (flushing, not-linked, eos)
+    gst_buffer_list_unref(list);
+    GST_PAD_PROBE_INFO_DATA(info) = nullptr;
+    GST_PAD_PROBE_INFO_FLOW_RETURN(info) = ret;
+
+    return GST_PAD_PROBE_HANDLED;
+}
+
+}
+
+SharedSourcePeer::SharedSourcePeer(
+    SharedSource* source,
+    const RoomInfo& room) noexcept :
+    _source(source), _room(room)
+{
+}
+
+SharedSourcePeer::~SharedSourcePeer()
+{
+    stop();
+}
+
+void SharedSourcePeer::prepare(
+    const std::deque<std::string>& iceServers,
+    const std::function<void ()>& prepared,
+    const std::function<void (unsigned mlineIndex, const std::string& candidate)>& iceCandidate,
+    const std::function<void ()>& eos) noexcept
+{
+    _iceServers = iceServers;
+    _prepared = prepared;
+    _iceCandidate = iceCandidate;
+    _eos = eos;
+
+    _id = _source->attach(this);
+    if(!_id) {
+        if(_eos)
+            _eos();
+        return;
+    }
+
+    if(_source->isReady())
+        onSourceReady();
+}
+
+const std::string& SharedSourcePeer::sdp() noexcept
+{
+    return _sdp;
+}
+
+void SharedSourcePeer::setRemoteSdp(const std::string& sdp) noexcept
+{
+    if(!_webrtcbinPtr)
+        return;
+
+    GstSDPMessage* sdpMessage = nullptr;
+    gst_sdp_message_new(&sdpMessage);
+    if(GST_SDP_OK != gst_sdp_message_parse_buffer(
+        reinterpret_cast<const guint8*>(sdp.data()), sdp.size(), sdpMessage))
+    {
+        Log()->error("Fail parse remote SDP");
+        gst_sdp_message_free(sdpMessage);
+        return;
+    }
+
+    GstWebRTCSessionDescription* answer =
+        gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdpMessage);
+    g_signal_emit_by_name(
+        _webrtcbinPtr.get(),
+        "set-remote-description", answer, nullptr);
+    gst_webrtc_session_description_free(answer);
+}
+
+void SharedSourcePeer::addIceCandidate(
+    unsigned mlineIndex,
+    const std::string& candidate) noexcept
+{
+    if(!_webrtcbinPtr || candidate.empty())
+        return;
+
+    g_signal_emit_by_name(
+        _webrtcbinPtr.get(),
+        "add-ice-candidate", mlineIndex, candidate.c_str());
+}
+
+void SharedSourcePeer::play() noexcept
+{
+    // source pipeline is playing already
+}
+
+void SharedSourcePeer::stop() noexcept
+{
+    removeBranch();
+
+    if(_id) {
+        _source->detach(_id);
+        _id = 0;
+    }
+}
+
+void SharedSourcePeer::onSourceReady()
+{
+    if(_webrtcbinPtr)
+        return;
+
+    if(!createBranch()) {
+        Log()->error("Fail create peer for shared source \"{}\"", _source->name());
+        removeBranch();
+        if(_eos)
+            _eos();
+    }
+}
+
+void SharedSourcePeer::onSourceEos()
+{
+    stop();
+
+    if(_eos)
+        _eos();
+}
+
+void SharedSourcePeer::onPrepared(const std::string& sdp)
+{
+    if(!_sdp.empty() && !_restartingIce)
+        return;
+
+    _sdp = sdp;
+    _restartingIce = false;
+
+    if(_prepared)
+        _prepared();
+}
+
+void SharedSourcePeer::onIceCandidate(
+    unsigned mlineIndex,
+    const std::string& candidate)
+{
+    if(_iceCandidate)
+        _iceCandidate(mlineIndex, candidate);
+}
+
+void SharedSourcePeer::setConnectionStateCallback(
+    const ConnectionStateChanged& connectionStateChanged) noexcept
+{
+    _connectionStateChanged = connectionStateChanged;
+}
+
+bool SharedSourcePeer::restartIce() noexcept
+{
+    GstElement* webrtcbin = _webrtcbinPtr.get();
+    if(!webrtcbin || _sdp.empty() || _restartingIce)
+        return false;
+
+    Log()->info("Restarting ICE of peer #{} of shared source \"{}\"", _id, _source->name());
+
+    _restartingIce = true;
+
+    GstStructure* options =
+        gst_structure_new(
+            "offer-options",
+            "ice-restart", G_TYPE_BOOLEAN, TRUE,
+            nullptr);
+    GstPromise* promise =
+        gst_promise_new_with_change_func(
+            OnOfferCreated,
+            gst_object_ref(webrtcbin),
+            gst_object_unref);
+    g_signal_emit_by_name(webrtcbin, "create-offer", options, promise);
+    gst_structure_free(options);
+
+    return true;
+}
+
+void SharedSourcePeer::onConnectionState(ConnectionState state)
+{
+    if(_connectionStateChanged)
+        _connectionStateChanged(state);
+}
+
+void SharedSourcePeer::onStats(double fractionLost, double roundTripTime)
+{
+    if(!_bitrateControllerPtr ||
+       !_bitrateControllerPtr->update(fractionLost, roundTripTime))
+    {
+        return;
+    }
+
+    const unsigned bitrate = _bitrateControllerPtr->bitrate();
+    Log()->trace(
+        "Peer #{} of shared source \"{}\": fraction lost {:.3f}, rtt {:.3f}s, bitrate {} kbit/s",
+        _id, _source->name(), fractionLost, roundTripTime, bitrate);
+
+    if(_transcoderPtr) {
+        GstElementPtr encoderPtr(gst_bin_get_by_name(GST_BIN(_transcoderPtr.get()), "encoder"));
+        if(encoderPtr)
+            SharedSource::SetEncoderBitrate(encoderPtr.get(), bitrate);
+    } else
+        _source->updateBitrate();
+}
+
+unsigned SharedSourcePeer::sourceBitrate() const noexcept
+{
+    if(_transcoderPtr || !_bitrateControllerPtr)
+        return 0;
+
+    return _bitrateControllerPtr->bitrate();
+}
+
+void SharedSourcePeer::createBitrateController()
+{
+    const StreamerConfig& config = _source->config();
+    if(config.maxBitrate == 0)
+        return;
+
+    // there is no sense to exceed room bitrate cap since Janus enforces it with REMB
+    const unsigned maxBitrate =
+        _room.bitrate > 0 ?
+            std::min(config.maxBitrate, _room.bitrate) :
+            config.maxBitrate;
+    _bitrateControllerPtr.reset(new BitrateController(config.minBitrate, maxBitrate));
+}
+
+void SharedSourcePeer::startRateControl()
+{
+    if(!_bitrateControllerPtr)
+        return;
+
+    // nothing to control for passthrough
+    if(!_transcoderPtr && !_source->encoder()) {
+        _bitrateControllerPtr.reset();
+        return;
+    }
+
+    _statsTimeoutPtr.reset(g_timeout_source_new(STATS_INTERVAL));
+    g_source_set_callback(
+        _statsTimeoutPtr.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<SharedSourcePeer*>(userData)->requestStats();
+            return G_SOURCE_CONTINUE;
+        }, this, nullptr);
+    g_source_attach(_statsTimeoutPtr.get(), g_main_context_get_thread_default());
+}
+
+void SharedSourcePeer::startPacing()
+{
+    const StreamerConfig& config = _source->config();
+    if(config.pacingFactor <= 0)
+        return;
+
+    _pacerPtr = std::make_shared<Pacer>(config.pacingFactor, config.pacingMaxDelay);
+
+    // encoder of transcoder would recreate keyframe burst,
+    // so it's paced right in front of webrtcbin
+    GstPadPtr srcPadPtr(
+        gst_element_get_static_pad(
+            _transcoderPtr ? _transcoderPtr.get() : _queuePtr.get(),
+            "src"));
+    gst_pad_add_probe(
+        srcPadPtr.get(),
+        static_cast<GstPadProbeType>(
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        PacePackets,
+        new Pacing { _pacerPtr, false },
+        [] (gpointer userData) {
+            delete static_cast<Pacing*>(userData);
+        });
+
+    _pacerStatsTimeoutPtr.reset(g_timeout_source_new_seconds(PACER_STATS_INTERVAL));
+    g_source_set_callback(
+        _pacerStatsTimeoutPtr.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<SharedSourcePeer*>(userData)->logPacerStats();
+            return G_SOURCE_CONTINUE;
+        }, this, nullptr);
+    g_source_attach(_pacerStatsTimeoutPtr.get(), g_main_context_get_thread_default());
+}
+
+void SharedSourcePeer::logPacerStats()
+{
+    if(!_pacerPtr || !_queuePtr)
+        return;
+
+    const Pacer::Stats stats = _pacerPtr->takeStats();
+
+    guint queueDepth = 0;
+    g_object_get(_queuePtr.get(), "current-level-buffers", &queueDepth, nullptr);
+
+    Log()->debug(
+        "Peer #{} of shared source \"{}\" pacer: {} packets, "
+        "delay avg {:.1f}ms max {:.1f}ms, queue depth {} packets",
+        _id, _source->name(), stats.packets,
+        stats.averageDelay / 1000., stats.maxDelay / 1000.,
+        queueDepth);
+}
+
+void SharedSourcePeer::startRecoveryStats()
+{
+    const StreamerConfig& config = _source->config();
+    if(!config.rtx && config.fecPercentage == 0)
+        return;
+
+    _recoveryStatsTimeoutPtr.reset(g_timeout_source_new_seconds(RECOVERY_STATS_INTERVAL));
+    g_source_set_callback(
+        _recoveryStatsTimeoutPtr.get(),
+        [] (gpointer userData) -> gboolean {
+            static_cast<SharedSourcePeer*>(userData)->logRecoveryStats();
+            return G_SOURCE_CONTINUE;
+        }, this, nullptr);
+    g_source_attach(_recoveryStatsTimeoutPtr.get(), g_main_context_get_thread_default());
+}
+
+// packets recovery itself happens on Janus side,
+// so only sender side counters are available
+void SharedSourcePeer::logRecoveryStats()
+{
+    GstElement* webrtcbin = _webrtcbinPtr.get();
+    if(!webrtcbin)
+        return;
+
+    Log()->debug(
+        "Peer #{} of shared source \"{}\" recovery: "
+        "{} retransmission requests, {} packets retransmitted, {} packets protected by FEC",
+        _id, _source->name(),
+        SumProperty(webrtcbin, "rtprtxsend", "num-rtx-requests"),
+        SumProperty(webrtcbin, "rtprtxsend", "num-rtx-packets"),
+        SumProperty(webrtcbin, "rtpulpfecenc", "protected"));
+}
+
+void SharedSourcePeer::requestStats()
+{
+    GstElement* webrtcbin = _webrtcbinPtr.get();
+    if(!webrtcbin)
+        return;
+
+    GstPromise* promise =
+        gst_promise_new_with_change_func(
+            OnStats,
+            gst_object_ref(webrtcbin),
+            gst_object_unref);
+    g_signal_emit_by_name(webrtcbin, "get-stats", nullptr, promise);
+}
+
+bool SharedSourcePeer::createBranch()
+{
+    GstElement* pipeline = _source->pipeline();
+    GstElement* tee = _source->tee();
+    if(!pipeline || !tee)
+        return false;
+
+    _queuePtr.reset(MakeElement("queue"));
+    _webrtcbinPtr.reset(MakeElement("webrtcbin"));
+    if(!_queuePtr || !_webrtcbinPtr)
+        return false;
+
+    GstElement* queue = _queuePtr.get();
+    GstElement* webrtcbin = _webrtcbinPtr.get();
+    const StreamerConfig& config = _source->config();
+
+    // slow peer should not block other peers
+    g_object_set(queue, "leaky", 2 /* downstream */, nullptr);
+
+    std::shared_ptr<GopCache> gopCachePtr = _source->gopCache();
+    if(_source->config().pacingFactor > 0) {
+        // keyframe burst waiting for pacer should not be leaked
+        g_object_set(queue, "max-size-buffers", 0u, nullptr);
+    }
+
+    g_object_set(webrtcbin, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, nullptr);
+    // otherwise Janus learns host addresses from connectivity checks anyway
+    if(_source->iceTransportPolicy() == IceConfig::TransportPolicy::Relay) {
+        g_object_set(
+            webrtcbin,
+            "ice-transport-policy", GST_WEBRTC_ICE_TRANSPORT_POLICY_RELAY,
+            nullptr);
+    }
+    for(const std::string& server: _iceServers) {
+        if(g_str_has_prefix(server.c_str(), "stun://")) {
+            g_object_set(webrtcbin, "stun-server", server.c_str(), nullptr);
+        } else if(g_str_has_prefix(server.c_str(), "turn://") ||
+                  g_str_has_prefix(server.c_str(), "turns://"))
+        {
+            gboolean added = FALSE;
+            g_signal_emit_by_name(webrtcbin, "add-turn-server", server.c_str(), &added);
+        }
+    }
+
+    g_object_set_data(G_OBJECT(webrtcbin), PeerIdKey, GUINT_TO_POINTER(_id));
+
+    g_signal_connect(webrtcbin, "on-negotiation-needed",
+        G_CALLBACK(OnNegotiationNeeded), nullptr);
+    g_signal_connect(webrtcbin, "on-ice-candidate",
+        G_CALLBACK(OnIceCandidate), nullptr);
+    g_signal_connect(webrtcbin, "notify::ice-gathering-state",
+        G_CALLBACK(OnIceGatheringStateChanged), nullptr);
+    if(config.rtx && config.rtxBuffer > 0) {
+        // rtprtxsend is created by webrtcbin internally
+        g_signal_connect(webrtcbin, "deep-element-added",
+            G_CALLBACK(OnDeepElementAdded), GUINT_TO_POINTER(config.rtxBuffer));
+    }
+    g_signal_connect(webrtcbin, "notify::ice-connection-state",
+        G_CALLBACK(OnConnectionStateChanged), nullptr);
+    g_signal_connect(webrtcbin, "notify::connection-state",
+        G_CALLBACK(OnConnectionStateChanged), nullptr);
+
+    gst_bin_add_many(GST_BIN(pipeline), queue, webrtcbin, nullptr);
+
+    createBitrateController();
+
+    if(!createTranscoder())
+        return false;
+
+    GstElement* transcoder = _transcoderPtr.get();
+    if(transcoder)
+        gst_bin_add(GST_BIN(pipeline), transcoder);
+
+    GstPadPtr queueSrcPadPtr(gst_element_get_static_pad(queue, "src"));
+    GstPadPtr webrtcSinkPadPtr(gst_element_get_request_pad(webrtcbin, "sink_%u"));
+    if(!webrtcSinkPadPtr)
+        return false;
+
+    if(transcoder) {
+        GstPadPtr transcoderSinkPadPtr(gst_element_get_static_pad(transcoder, "sink"));
+        GstPadPtr transcoderSrcPadPtr(gst_element_get_static_pad(transcoder, "src"));
+        if(GST_PAD_LINK_OK != gst_pad_link(queueSrcPadPtr.get(), transcoderSinkPadPtr.get()) ||
+           GST_PAD_LINK_OK != gst_pad_link(transcoderSrcPadPtr.get(), webrtcSinkPadPtr.get()))
+        {
+            return false;
+        }
+    } else if(GST_PAD_LINK_OK != gst_pad_link(queueSrcPadPtr.get(), webrtcSinkPadPtr.get()))
+        return false;
+
+    GstWebRTCRTPTransceiver* transceiver = nullptr;
+    g_signal_emit_by_name(webrtcbin, "get-transceiver", 0, &transceiver);
+    if(transceiver) {
+        g_object_set(
+            transceiver,
+            "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY,
+            nullptr);
+        // rtx/red/ulpfec payloads are added to offer
+        // and are used only if Janus accepts them
+        if(config.rtx)
+            g_object_set(transceiver, "do-nack", TRUE, nullptr);
+        if(config.fecPercentage > 0) {
+            g_object_set(
+                transceiver,
+                "fec-type", GST_WEBRTC_FEC_TYPE_ULP_RED,
+                "fec-percentage", config.fecPercentage,
+                nullptr);
+        }
+        gst_object_unref(transceiver);
+    }
+
+    gst_element_sync_state_with_parent(webrtcbin);
+    if(transcoder)
+        gst_element_sync_state_with_parent(transcoder);
+    gst_element_sync_state_with_parent(queue);
+
+    _teePadPtr.reset(gst_element_get_request_pad(tee, "src_%u"));
+    GstPadPtr queueSinkPadPtr(gst_element_get_static_pad(queue, "sink"));
+
+    if(gopCachePtr) {
+        // transcoder serves keyframe requests itself
+        const GstPadProbeType keyframeRequests =
+            transcoder ? GST_PAD_PROBE_TYPE_INVALID : GST_PAD_PROBE_TYPE_EVENT_UPSTREAM;
+        gst_pad_add_probe(
+            queueSinkPadPtr.get(),
+            static_cast<GstPadProbeType>(
+                GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | keyframeRequests),
+            SpliceGop,
+            new GopSplice(gopCachePtr, webrtcbin, queue),
+            [] (gpointer userData) {
+                delete static_cast<GopSplice*>(userData);
+            });
+    }
+
+    if(!_teePadPtr ||
+       GST_PAD_LINK_OK != gst_pad_link(_teePadPtr.get(), queueSinkPadPtr.get()))
+    {
+        return false;
+    }
+
+    // don't make new peer wait for next natural keyframe
+    if(!gopCachePtr)
+        gst_pad_push_event(queueSinkPadPtr.get(), NewForceKeyUnitEvent());
+
+    startRateControl();
+    startPacing();
+    startRecoveryStats();
+
+    return true;
+}
+
+bool SharedSourcePeer::createTranscoder()
+{
+    GstRtStreaming::Videocodec sourceVideocodec;
+    if(_room.videocodecs.empty() ||
+       !_source->videocodec(&sourceVideocodec) ||
+       IsAllowed(sourceVideocodec, _room.videocodecs))
+    {
+        // passthrough
+        return true;
+    }
+
+    const GstRtStreaming::Videocodec targetVideocodec = _room.videocodecs.front();
+
+    Log()->info(
+        "Shared source \"{}\" is transcoded from {} to {} for peer #{}",
+        _source->name(),
+        VideocodecName(sourceVideocodec),
+        VideocodecName(targetVideocodec),
+        _id);
+
+    GError* error = nullptr;
+    GstElement* transcoder =
+        gst_parse_bin_from_description(
+            _source->transcoder(
+                targetVideocodec,
+                _bitrateControllerPtr ? _bitrateControllerPtr->bitrate() : 0).c_str(),
+            TRUE,
+            &error);
+    GErrorPtr errorPtr(error);
+    if(error) {
+        Log()->error(
+            "Fail create transcoder for shared source \"{}\": {}",
+            _source->name(), error->message);
+        if(transcoder)
+            gst_object_unref(transcoder);
+        return false;
+    }
+
+    _transcoderPtr.reset(GST_ELEMENT(gst_object_ref_sink(transcoder)));
+    _governorClient.attach(_transcoderPtr.get(), _source->config().priority);
+
+    return true;
+}
+
+void SharedSourcePeer::removeBranch()
+{
+    if(_statsTimeoutPtr) {
+        g_source_destroy(_statsTimeoutPtr.get());
+        _statsTimeoutPtr.reset();
+    }
+    _bitrateControllerPtr.reset();
+    _governorClient.detach();
+
+    if(_pacerStatsTimeoutPtr) {
+        g_source_destroy(_pacerStatsTimeoutPtr.get());
+        _pacerStatsTimeoutPtr.reset();
+    }
+    _pacerPtr.reset();
+
+    if(_recoveryStatsTimeoutPtr) {
+        g_source_destroy(_recoveryStatsTimeoutPtr.get());
+        _recoveryStatsTimeoutPtr.reset();
+    }
+
+    if(!_queuePtr && !_transcoderPtr && !_webrtcbinPtr)
+        return;
+
+    _source->removeBranch(
+        _teePadPtr.get(),
+        std::move(_queuePtr),
+        std::move(_transcoderPtr),
+        std::move(_webrtcbinPtr));
+
+    _teePadPtr.reset();
+}
+
+void SharedSourcePeer::OnNegotiationNeeded(
+    GstElement* webrtcbin,
+    gpointer /*userData*/)
+{
+    GstPromise* promise =
+        gst_promise_new_with_change_func(
+            OnOfferCreated,
+            gst_object_ref(webrtcbin),
+            gst_object_unref);
+    g_signal_emit_by_name(webrtcbin, "create-offer", nullptr, promise);
+}
+
+void SharedSourcePeer::OnOfferCreated(GstPromise* promise, gpointer userData)
+{
+    GstElement* webrtcbin = GST_ELEMENT(userData);
+
+    GstWebRTCSessionDescription* offer = nullptr;
+    if(GST_PROMISE_RESULT_REPLIED == gst_promise_wait(promise)) {
+        const GstStructure* reply = gst_promise_get_reply(promise);
+        gst_structure_get(
+            reply,
+            "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer,
+            nullptr);
+    }
+    gst_promise_unref(promise);
+
+    if(!offer) {
+        Log()->error("Fail create offer");
+        return;
+    }
+
+    g_signal_emit_by_name(webrtcbin, "set-local-description", offer, nullptr);
+
+    GCharPtr sdpPtr(gst_sdp_message_as_text(offer->sdp));
+    gst_webrtc_session_description_free(offer);
+
+    PostPeerMessage(
+        webrtcbin,
+        gst_structure_new(
+            "peer-prepared",
+            "sdp", G_TYPE_STRING, sdpPtr.get(),
+            nullptr));
+}
+
+// runs on webrtcbin thread
+void SharedSourcePeer::OnStats(GstPromise* promise, gpointer userData)
+{
+    GstElement* webrtcbin = GST_ELEMENT(userData);
+
+    if(GST_PROMISE_RESULT_REPLIED != gst_promise_wait(promise)) {
+        gst_promise_unref(promise);
+        return;
+    }
+
+    struct RemoteStats {
+        gdouble fractionLost = 0;
+        gdouble roundTripTime = -1;
+        bool found = false;
+    } remoteStats;
+
+    gst_structure_foreach(
+        gst_promise_get_reply(promise),
+        [] (GQuark, const GValue* value, gpointer userData) -> gboolean {
+            if(!GST_VALUE_HOLDS_STRUCTURE(value))
+                return TRUE;
+
+            const GstStructure* stats = gst_value_get_structure(value);
+            GstWebRTCStatsType type;
+            if(!gst_structure_get(stats, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, nullptr) ||
+               type != GST_WEBRTC_STATS_REMOTE_INBOUND_RTP)
+            {
+                return TRUE;
+            }
+
+            RemoteStats* remoteStats = static_cast<RemoteStats*>(userData);
+            remoteStats->found = true;
+
+            gdouble fractionLost;
+            if(gst_structure_get_double(stats, "fraction-lost", &fractionLost))
+                remoteStats->fractionLost = std::max(remoteStats->fractionLost, fractionLost);
+
+            gdouble roundTripTime;
+            if(gst_structure_get_double(stats, "round-trip-time", &roundTripTime))
+                remoteStats->roundTripTime = std::max(remoteStats->roundTripTime, roundTripTime);
+
+            return TRUE;
+        }, &remoteStats);
+
+    gst_promise_unref(promise);
+
+    // no receiver reports yet
+    if(!remoteStats.found)
+        return;
+
+    PostPeerMessage(
+        webrtcbin,
+        gst_structure_new(
+            "peer-stats",
+            "fraction-lost", G_TYPE_DOUBLE, remoteStats.fractionLost,
+            "round-trip-time", G_TYPE_DOUBLE, remoteStats.roundTripTime,
+            nullptr));
+}
+
+void SharedSourcePeer::OnIceCandidate(
+    GstElement* webrtcbin,
+    guint mlineIndex,
+    gchar* candidate,
+    gpointer /*userData*/)
+{
+    PostPeerMessage(
+        webrtcbin,
+        gst_structure_new(
+            "peer-ice-candidate",
+            "mline-index", G_TYPE_UINT, mlineIndex,
+            "candidate", G_TYPE_STRING, candidate,
+            nullptr));
+}
+
+void SharedSourcePeer::OnIceGatheringStateChanged(
+    GstElement* webrtcbin,
+    GParamSpec*,
+    gpointer /*userData*/)
+{
+    GstWebRTCICEGatheringState state = GST_WEBRTC_ICE_GATHERING_STATE_NEW;
+    g_object_get(webrtcbin, "ice-gathering-state", &state, nullptr);
+    if(state != GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE)
+        return;
+
+    PostPeerMessage(
+        webrtcbin,
+        gst_structure_new(
+            "peer-ice-candidate",
+            "mline-index", G_TYPE_UINT, 0u,
+            "candidate", G_TYPE_STRING, "a=end-of-candidates",
+            nullptr));
+}
+
+// runs on arbitrary thread
+void SharedSourcePeer::OnDeepElementAdded(
+    GstBin* /*webrtcbin*/,
+    GstBin* /*subBin*/,
+    GstElement* element,
+    gpointer userData)
+{
+    // bounded by time to not retransmit packets too late to be useful
+    const guint rtxBuffer = GPOINTER_TO_UINT(userData);
+
+    if(IsMadeBy(element, "rtprtxsend")) {
+        g_object_set(element, "max-size-time", rtxBuffer, nullptr);
+    } else if(GST_IS_BIN(element)) {
+        // aux sender bin is populated before it's added to rtpbin,
+        // so signal is emitted only for bin itself
+        SetProperty(element, "rtprtxsend", "max-size-time", rtxBuffer);
+    }
+}
+
+// ICE failure can be recovered with ICE restart,
+// DTLS failure (with alive ICE) - only with peer recreation
+void SharedSourcePeer::OnConnectionStateChanged(
+    GstElement* webrtcbin,
+    GParamSpec*,
+    gpointer /*userData*/)
+{
+    GstWebRTCICEConnectionState iceState = GST_WEBRTC_ICE_CONNECTION_STATE_NEW;
+    GstWebRTCPeerConnectionState state = GST_WEBRTC_PEER_CONNECTION_STATE_NEW;
+    g_object_get(
+        webrtcbin,
+        "ice-connection-state", &iceState,
+        "connection-state", &state,
+        nullptr);
+
+    ConnectionState connectionState;
+    if(iceState == GST_WEBRTC_ICE_CONNECTION_STATE_FAILED)
+        connectionState = ConnectionState::IceFailed;
+    else if(state == GST_WEBRTC_PEER_CONNECTION_STATE_FAILED)
+        connectionState = ConnectionState::Failed;
+    else if(state == GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED)
+        connectionState = ConnectionState::Connected;
+    else
+        return;
+
+    PostPeerMessage(
+        webrtcbin,
+        gst_structure_new(
+            "peer-connection-state",
+            "state", G_TYPE_INT, static_cast<gint>(connectionState),
+            nullptr));
+}
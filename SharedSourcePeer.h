@@ -0,0 +1,124 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <functional>
+
+#include <gst/gst.h>
+
+#include "CxxPtr/GstPtr.h"
+#include "CxxPtr/GlibPtr.h"
+
+#include "RtStreaming/WebRTCPeer.h"
+
+#include "RestartablePeer.h"
+#include "RoomInfo.h"
+#include "BitrateController.h"
+#include "CpuGovernor.h"
+#include "Pacer.h"
+
+
+class SharedSource;
+
+// WebRTC peer fed from SharedSource.
+// Every peer is a separate "queue ! webrtcbin" branch of SharedSource pipeline
+// ("queue ! transcoder ! webrtcbin" if source codec is not allowed).
+class SharedSourcePeer : public WebRTCPeer, public RestartablePeer
+{
+public:
+    SharedSourcePeer(SharedSource*, const RoomInfo&) noexcept;
+    ~SharedSourcePeer();
+
+    void prepare(
+        const std::deque<std::string>& iceServers,
+        const std::function<void ()>& prepared,
+        const std::function<void (unsigned mlineIndex, const std::string& candidate)>& iceCandidate,
+        const std::function<void ()>& eos) noexcept override;
+
+    const std::string& sdp() noexcept override;
+
+    void setRemoteSdp(const std::string& sdp) noexcept override;
+    void addIceCandidate(unsigned mlineIndex, const std::string& candidate) noexcept override;
+
+    void play() noexcept override;
+    void stop() noexcept override;
+
+    void setConnectionStateCallback(const ConnectionStateChanged&) noexcept override;
+    bool restartIce() noexcept override;
+
+private:
+    friend class SharedSource;
+
+    void onSourceReady();
+    void onSourceEos();
+    void onPrepared(const std::string& sdp);
+    void onIceCandidate(unsigned mlineIndex, const std::string& candidate);
+    void onStats(double fractionLost, double roundTripTime);
+    void onConnectionState(ConnectionState);
+
+    // bitrate (kbit/s) peer can receive from shared encoder, 0 - unknown
+    unsigned sourceBitrate() const noexcept;
+
+private:
+    bool createBranch();
+    bool createTranscoder();
+    void createBitrateController();
+    void startRateControl();
+    void startPacing();
+    void logPacerStats();
+    void startRecoveryStats();
+    void logRecoveryStats();
+    void requestStats();
+    void removeBranch();
+
+    static void OnNegotiationNeeded(GstElement* webrtcbin, gpointer userData);
+    static void OnOfferCreated(GstPromise*, gpointer userData);
+    static void OnStats(GstPromise*, gpointer userData);
+    static void OnIceCandidate(
+        GstElement* webrtcbin,
+        guint mlineIndex,
+        gchar* candidate,
+        gpointer userData);
+    static void OnIceGatheringStateChanged(
+        GstElement* webrtcbin,
+        GParamSpec*,
+        gpointer userData);
+    static void OnDeepElementAdded(
+        GstBin* webrtcbin,
+        GstBin* subBin,
+        GstElement*,
+        gpointer userData);
+    static void OnConnectionStateChanged(
+        GstElement* webrtcbin,
+        GParamSpec*,
+        gpointer userData);
+
+private:
+    SharedSource *const _source;
+    const RoomInfo _room;
+    unsigned _id = 0;
+
+    std::deque<std::string> _iceServers;
+    std::function<void ()> _prepared;
+    std::function<void (unsigned, const std::string&)> _iceCandidate;
+    std::function<void ()> _eos;
+    ConnectionStateChanged _connectionStateChanged;
+
+    GstElementPtr _queuePtr;
+    GstElementPtr _transcoderPtr;
+    CpuGovernor::Client _governorClient;
+    GstElementPtr _webrtcbinPtr;
+    GstPadPtr _teePadPtr;
+
+    std::unique_ptr<BitrateController> _bitrateControllerPtr;
+    GSourcePtr _statsTimeoutPtr;
+
+    std::shared_ptr<Pacer> _pacerPtr;
+    GSourcePtr _pacerStatsTimeoutPtr;
+
+    GSourcePtr _recoveryStatsTimeoutPtr;
+
+    std::string _sdp;
+    bool _restartingIce = false;
+};
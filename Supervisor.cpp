@@ -0,0 +1,270 @@
+#include "Supervisor.h"
+
+#include <new>
+#include <csignal>
+#include <algorithm>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+#include "Log.h"
+
+
+namespace {
+
+enum {
+    POLL_INTERVAL = 1, // s
+    STATUS_LOG_INTERVAL = 60, // s
+    HEARTBEAT_TIMEOUT = 60, // s
+};
+
+const auto Log = ClientLog;
+
+volatile std::sig_atomic_t StopRequested = 0;
+
+void OnStopSignal(int)
+{
+    StopRequested = 1;
+}
+
+}
+
+Supervisor::Supervisor(
+    const SupervisorConfig& config,
+    const std::vector<std::vector<unsigned>>& shards,
+    const RunShard& runShard) noexcept :
+    _config(config), _shards(shards), _runShard(runShard),
+    _shardsState(shards.size())
+{
+    void* status =
+        mmap(
+            nullptr,
+            sizeof(ProcessStatus) * std::max<size_t>(shards.size(), 1),
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS,
+            -1, 0);
+    if(status == MAP_FAILED) {
+        Log()->critical("Fail allocate shared memory for processes status");
+        return;
+    }
+
+    _status = static_cast<ProcessStatus*>(status);
+    for(unsigned shard = 0; shard < shards.size(); ++shard)
+        new(&_status[shard]) ProcessStatus { {0}, {0}, {0}, {0} };
+
+    for(Shard& shard: _shardsState)
+        shard.restartTimeout = _config.restartTimeout;
+}
+
+Supervisor::~Supervisor()
+{
+    if(_status)
+        munmap(_status, sizeof(ProcessStatus) * std::max<size_t>(_shards.size(), 1));
+}
+
+bool Supervisor::startShard(unsigned shard)
+{
+    Shard& state = _shardsState[shard];
+    ProcessStatus* status = &_status[shard];
+
+    const pid_t supervisorPid = getpid();
+
+    const pid_t pid = fork();
+    if(pid < 0) {
+        Log()->error("Fail fork worker process for shard #{}", shard);
+        return false;
+    }
+
+    if(pid == 0) {
+        std::signal(SIGTERM, SIG_DFL);
+        std::signal(SIGINT, SIG_DFL);
+
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        if(getppid() != supervisorPid)
+            _exit(EXIT_FAILURE);
+
+        if(_config.cpuAffinity) {
+#ifdef __linux__
+            const unsigned cpuCount = std::max(1u, std::thread::hardware_concurrency());
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(shard % cpuCount, &cpuSet);
+            if(0 != sched_setaffinity(0, sizeof(cpuSet), &cpuSet))
+                Log()->warn("Fail set CPU affinity of shard #{}", shard);
+#else
+            Log()->warn("CPU affinity is not supported on this platform");
+#endif
+        }
+
+        _exit(_runShard(shard, _shards[shard], status));
+    }
+
+    const gint64 now = g_get_monotonic_time();
+
+    state.pid = pid;
+    state.restartTime = 0;
+
+    status->pid = pid;
+    status->startTime = now;
+    status->heartbeat = now;
+
+    Log()->info(
+        "Started worker process {} for shard #{} ({} stream(s))",
+        pid, shard, _shards[shard].size());
+
+    return true;
+}
+
+void Supervisor::onShardExit(unsigned shard, int status)
+{
+    Shard& state = _shardsState[shard];
+    ProcessStatus* processStatus = &_status[shard];
+
+    if(WIFSIGNALED(status)) {
+        Log()->error(
+            "Worker process {} of shard #{} killed by signal {}",
+            state.pid, shard, WTERMSIG(status));
+    } else {
+        Log()->error(
+            "Worker process {} of shard #{} exited with code {}",
+            state.pid, shard, WEXITSTATUS(status));
+    }
+
+    const gint64 now = g_get_monotonic_time();
+    const gint64 uptime = now - processStatus->startTime;
+
+    // process that worked long enough is restarted without delay growth
+    if(uptime > static_cast<gint64>(_config.maxRestartTimeout) * G_USEC_PER_SEC)
+        state.restartTimeout = _config.restartTimeout;
+
+    state.pid = 0;
+    state.restartTime = now + static_cast<gint64>(state.restartTimeout) * G_USEC_PER_SEC;
+
+    Log()->info(
+        "Scheduling restart of shard #{} in {} seconds...",
+        shard, state.restartTimeout);
+
+    state.restartTimeout =
+        std::min(
+            std::max(state.restartTimeout, 1u) * 2,
+            std::max(_config.maxRestartTimeout, _config.restartTimeout));
+
+    processStatus->pid = 0;
+    ++processStatus->restarts;
+}
+
+void Supervisor::checkHeartbeats()
+{
+    const gint64 now = g_get_monotonic_time();
+
+    for(unsigned shard = 0; shard < _shardsState.size(); ++shard) {
+        const Shard& state = _shardsState[shard];
+        if(!state.pid)
+            continue;
+
+        const gint64 heartbeat = _status[shard].heartbeat;
+        if(now - heartbeat > static_cast<gint64>(HEARTBEAT_TIMEOUT) * G_USEC_PER_SEC) {
+            Log()->error(
+                "Worker process {} of shard #{} is not responding. Killing...",
+                state.pid, shard);
+            kill(state.pid, SIGKILL);
+        }
+    }
+}
+
+void Supervisor::logStatus()
+{
+    const gint64 now = g_get_monotonic_time();
+
+    for(unsigned shard = 0; shard < _shardsState.size(); ++shard) {
+        const ProcessStatus& status = _status[shard];
+        if(status.pid)
+            Log()->info(
+                "Shard #{}: pid {}, uptime {}s, restarts {}",
+                shard,
+                status.pid.load(),
+                (now - status.startTime) / G_USEC_PER_SEC,
+                status.restarts.load());
+        else
+            Log()->info(
+                "Shard #{}: not running, restarts {}",
+                shard,
+                status.restarts.load());
+    }
+}
+
+void Supervisor::stopAll()
+{
+    for(const Shard& state: _shardsState) {
+        if(state.pid)
+            kill(state.pid, SIGTERM);
+    }
+
+    for(Shard& state: _shardsState) {
+        if(state.pid) {
+            waitpid(state.pid, nullptr, 0);
+            state.pid = 0;
+        }
+    }
+}
+
+int Supervisor::run() noexcept
+{
+    if(!_status)
+        return -1;
+
+    std::signal(SIGTERM, OnStopSignal);
+    std::signal(SIGINT, OnStopSignal);
+
+    Log()->info("Supervising {} worker process(es)...", _shards.size());
+
+    for(unsigned shard = 0; shard < _shards.size(); ++shard) {
+        if(!startShard(shard))
+            _shardsState[shard].restartTime = g_get_monotonic_time();
+    }
+
+    gint64 lastStatusLog = g_get_monotonic_time();
+    while(!StopRequested) {
+        int status;
+        pid_t pid;
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = std::find_if(
+                _shardsState.begin(), _shardsState.end(),
+                [pid] (const Shard& shard) { return shard.pid == pid; });
+            if(it != _shardsState.end())
+                onShardExit(it - _shardsState.begin(), status);
+        }
+
+        const gint64 now = g_get_monotonic_time();
+        for(unsigned shard = 0; shard < _shardsState.size(); ++shard) {
+            Shard& state = _shardsState[shard];
+            if(!state.pid && state.restartTime && now >= state.restartTime) {
+                if(!startShard(shard))
+                    state.restartTime = now + POLL_INTERVAL * G_USEC_PER_SEC;
+            }
+        }
+
+        checkHeartbeats();
+
+        if(now - lastStatusLog > static_cast<gint64>(STATUS_LOG_INTERVAL) * G_USEC_PER_SEC) {
+            logStatus();
+            lastStatusLog = now;
+        }
+
+        sleep(POLL_INTERVAL);
+    }
+
+    Log()->info("Stopping worker processes...");
+
+    stopAll();
+
+    return 0;
+}
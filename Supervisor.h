@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#include <sys/types.h>
+
+#include <glib.h>
+
+
+struct SupervisorConfig
+{
+    bool enabled = false;
+    unsigned processes = 0; // 0 - process per stream (or per shared source)
+    bool cpuAffinity = false;
+    unsigned restartTimeout = 1;
+    unsigned maxRestartTimeout = 60;
+};
+
+// Lives in memory shared between supervisor and it's worker processes
+struct ProcessStatus
+{
+    std::atomic<pid_t> pid;
+    std::atomic<unsigned> restarts;
+    std::atomic<gint64> startTime; // monotonic time, us
+    std::atomic<gint64> heartbeat; // monotonic time, us
+};
+
+// Forks worker process per shard of streams and restarts crashed ones
+class Supervisor
+{
+public:
+    typedef std::function<
+        int (
+            unsigned shard,
+            const std::vector<unsigned>& streams,
+            ProcessStatus*) noexcept> RunShard;
+
+    Supervisor(
+        const SupervisorConfig&,
+        const std::vector<std::vector<unsigned>>& shards,
+        const RunShard&) noexcept;
+    ~Supervisor();
+
+    // returns only in supervisor process
+    int run() noexcept;
+
+private:
+    struct Shard
+    {
+        pid_t pid = 0;
+        unsigned restartTimeout = 0; // s
+        gint64 restartTime = 0; // monotonic time, us; 0 - no restart scheduled
+    };
+
+    bool startShard(unsigned shard);
+    void onShardExit(unsigned shard, int status);
+    void checkHeartbeats();
+    void logStatus();
+    void stopAll();
+
+private:
+    const SupervisorConfig _config;
+    const std::vector<std::vector<unsigned>> _shards;
+    const RunShard _runShard;
+
+    ProcessStatus* _status = nullptr;
+    std::vector<Shard> _shardsState;
+};
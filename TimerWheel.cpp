@@ -0,0 +1,196 @@
+#include "TimerWheel.h"
+
+#include <memory>
+#include <algorithm>
+
+
+namespace {
+
+enum {
+    // ticks to process at once after main loop was blocked
+    MAX_CATCH_UP_TICKS = 1000,
+};
+
+}
+
+TimerWheel::Timer::Timer(const Callback& callback) noexcept :
+    _callback(callback)
+{
+}
+
+TimerWheel::Timer::~Timer()
+{
+    stop();
+}
+
+void TimerWheel::Timer::start(unsigned delay) noexcept
+{
+    stop();
+
+    TimerWheel::ThreadDefault()->schedule(this, delay);
+}
+
+void TimerWheel::Timer::stop() noexcept
+{
+    if(!_wheel)
+        return;
+
+    unlink();
+
+    --_wheel->_timersCount;
+    _wheel = nullptr;
+}
+
+bool TimerWheel::Timer::active() const noexcept
+{
+    return _wheel != nullptr;
+}
+
+void TimerWheel::Timer::unlink() noexcept
+{
+    _prev->_next = _next;
+    _next->_prev = _prev;
+    _prev = _next = nullptr;
+}
+
+TimerWheel* TimerWheel::ThreadDefault() noexcept
+{
+    static thread_local std::unique_ptr<TimerWheel> wheel;
+    if(!wheel)
+        wheel = std::make_unique<TimerWheel>();
+
+    return wheel.get();
+}
+
+TimerWheel::TimerWheel() noexcept :
+    _context(g_main_context_ref_thread_default())
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+    if(_tickSourcePtr)
+        g_source_destroy(_tickSourcePtr.get());
+
+    g_main_context_unref(_context);
+}
+
+void TimerWheel::Append(Slot* slot, Timer* timer) noexcept
+{
+    Timer* head = &slot->head;
+    timer->_prev = head->_prev;
+    timer->_next = head;
+    head->_prev->_next = timer;
+    head->_prev = timer;
+}
+
+void TimerWheel::schedule(Timer* timer, unsigned delay) noexcept
+{
+    if(!_tickSourcePtr) {
+        _lastTickTime = g_get_monotonic_time();
+
+        _tickSourcePtr.reset(g_timeout_source_new(TICK));
+        g_source_set_callback(
+            _tickSourcePtr.get(),
+            [] (gpointer userData) -> gboolean {
+                static_cast<TimerWheel*>(userData)->onTick();
+                return G_SOURCE_CONTINUE;
+            }, this, nullptr);
+        g_source_attach(_tickSourcePtr.get(), _context);
+    }
+
+    const guint64 ticks = std::max<guint64>((delay + TICK - 1) / TICK, 1);
+
+    timer->_wheel = this;
+    timer->_expireTick = _currentTick + ticks;
+    ++_timersCount;
+
+    insert(timer);
+}
+
+void TimerWheel::insert(Timer* timer) noexcept
+{
+    const guint64 delta =
+        timer->_expireTick > _currentTick ? timer->_expireTick - _currentTick : 0;
+
+    if(delta < LEVEL0_SLOTS) {
+        Append(&_level0[timer->_expireTick % LEVEL0_SLOTS], timer);
+    } else if(delta < static_cast<guint64>(LEVEL0_SLOTS) * LEVEL1_SLOTS) {
+        Append(&_level1[(timer->_expireTick >> LEVEL0_BITS) % LEVEL1_SLOTS], timer);
+    } else {
+        // too far, will be reinserted on cascade
+        Append(
+            &_level1[((_currentTick >> LEVEL0_BITS) + LEVEL1_SLOTS - 1) % LEVEL1_SLOTS],
+            timer);
+    }
+}
+
+void TimerWheel::onTick() noexcept
+{
+    const gint64 now = g_get_monotonic_time();
+    const gint64 tickDuration = static_cast<gint64>(TICK) * 1000;
+
+    gint64 elapsedTicks = (now - _lastTickTime) / tickDuration;
+    _lastTickTime += elapsedTicks * tickDuration;
+
+    if(elapsedTicks > MAX_CATCH_UP_TICKS)
+        elapsedTicks = MAX_CATCH_UP_TICKS;
+
+    for(gint64 i = 0; i < elapsedTicks; ++i)
+        processTick();
+
+    if(_timersCount == 0 && _tickSourcePtr) {
+        g_source_destroy(_tickSourcePtr.get());
+        _tickSourcePtr.reset();
+    }
+}
+
+void TimerWheel::cascade() noexcept
+{
+    Slot& slot = _level1[(_currentTick >> LEVEL0_BITS) % LEVEL1_SLOTS];
+
+    Slot pending;
+    while(slot.head._next != &slot.head) {
+        Timer* timer = slot.head._next;
+        timer->unlink();
+        Append(&pending, timer);
+    }
+
+    while(pending.head._next != &pending.head) {
+        Timer* timer = pending.head._next;
+        timer->unlink();
+        insert(timer);
+    }
+}
+
+void TimerWheel::processTick() noexcept
+{
+    ++_currentTick;
+
+    if(_currentTick % LEVEL0_SLOTS == 0)
+        cascade();
+
+    Slot& slot = _level0[_currentTick % LEVEL0_SLOTS];
+
+    // callbacks are allowed to start/stop/destroy any timer,
+    // so expired timers are moved to separate list first
+    Slot expired;
+    Timer* timer = slot.head._next;
+    while(timer != &slot.head) {
+        Timer* next = timer->_next;
+        if(timer->_expireTick <= _currentTick) {
+            timer->unlink();
+            Append(&expired, timer);
+        }
+        timer = next;
+    }
+
+    while(expired.head._next != &expired.head) {
+        Timer* timer = expired.head._next;
+        timer->unlink();
+        timer->_wheel = nullptr;
+        --_timersCount;
+
+        timer->_callback();
+    }
+}
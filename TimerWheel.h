@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <functional>
+
+#include <glib.h>
+
+#include "CxxPtr/GlibPtr.h"
+
+
+// Hierarchical timer wheel shared by everything running on the same thread
+// (and so attached to the same thread default main context).
+// Single GSource wakes up once per tick regardless of timers count.
+class TimerWheel
+{
+public:
+    enum {
+        TICK = 100, // ms
+    };
+
+    class Timer
+    {
+    public:
+        typedef std::function<void ()> Callback;
+
+        explicit Timer(const Callback&) noexcept;
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer& operator = (const Timer&) = delete;
+
+        // (re)schedules timer on thread's wheel
+        void start(unsigned delay /* ms */) noexcept;
+        void stop() noexcept;
+        bool active() const noexcept;
+
+    private:
+        friend class TimerWheel;
+
+        void unlink() noexcept;
+
+    private:
+        const Callback _callback;
+
+        TimerWheel* _wheel = nullptr;
+        guint64 _expireTick = 0;
+
+        Timer* _prev = nullptr;
+        Timer* _next = nullptr;
+    };
+
+    // wheel of calling thread
+    static TimerWheel* ThreadDefault() noexcept;
+
+    TimerWheel() noexcept;
+    ~TimerWheel();
+
+private:
+    struct Slot
+    {
+        Slot() noexcept { head._prev = head._next = &head; }
+
+        Timer head { Timer::Callback() };
+    };
+
+    enum {
+        LEVEL0_BITS = 8,
+        LEVEL0_SLOTS = 1 << LEVEL0_BITS,
+        LEVEL1_SLOTS = 64,
+    };
+
+    void schedule(Timer*, unsigned delay) noexcept;
+    void insert(Timer*) noexcept;
+    static void Append(Slot*, Timer*) noexcept;
+
+    void onTick() noexcept;
+    void processTick() noexcept;
+    void cascade() noexcept;
+
+private:
+    GMainContext* _context;
+    GSourcePtr _tickSourcePtr;
+    gint64 _lastTickTime = 0;
+    guint64 _currentTick = 0;
+    unsigned _timersCount = 0;
+
+    std::array<Slot, LEVEL0_SLOTS> _level0;
+    std::array<Slot, LEVEL1_SLOTS> _level1;
+};
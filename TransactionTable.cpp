@@ -0,0 +1,110 @@
+#include "TransactionTable.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cerrno>
+
+
+TransactionId NextTransaction() noexcept
+{
+    static std::atomic<TransactionId> nextTransaction(1);
+    return nextTransaction++;
+}
+
+bool ParseTransaction(const char* transaction, TransactionId* id) noexcept
+{
+    if(!transaction || *transaction < '0' || *transaction > '9')
+        return false;
+
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long value = strtoull(transaction, &end, 10);
+    if(errno != 0 || *end != '\0' || value == 0)
+        return false;
+
+    *id = static_cast<TransactionId>(value);
+
+    return true;
+}
+
+const TransactionTable::Entry* TransactionTable::lookup(TransactionId id) const noexcept
+{
+    if(id == 0)
+        return nullptr;
+
+    for(const Entry& entry: _entries) {
+        if(entry.id == id)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+bool TransactionTable::add(
+    TransactionId id,
+    MessageType type,
+    gint64 now,
+    gint64 timeout) noexcept
+{
+    for(Entry& entry: _entries) {
+        if(entry.id != 0)
+            continue;
+
+        entry.id = id;
+        entry.type = type;
+        entry.sentTime = now;
+        entry.deadline = now + timeout;
+
+        return true;
+    }
+
+    return false;
+}
+
+bool TransactionTable::contains(TransactionId id) const noexcept
+{
+    return lookup(id) != nullptr;
+}
+
+bool TransactionTable::find(TransactionId id, MessageType* type) const noexcept
+{
+    const Entry* entry = lookup(id);
+    if(!entry)
+        return false;
+
+    *type = entry->type;
+
+    return true;
+}
+
+void TransactionTable::remove(TransactionId id) noexcept
+{
+    if(Entry* entry = const_cast<Entry*>(lookup(id)))
+        entry->id = 0;
+}
+
+void TransactionTable::clear() noexcept
+{
+    for(Entry& entry: _entries)
+        entry.id = 0;
+}
+
+bool TransactionTable::expired(
+    gint64 now,
+    TransactionId* id,
+    MessageType* type,
+    gint64* sentTime) const noexcept
+{
+    for(const Entry& entry: _entries) {
+        if(entry.id == 0 || entry.deadline > now)
+            continue;
+
+        *id = entry.id;
+        *type = entry.type;
+        *sentTime = entry.sentTime;
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+
+#include <glib.h>
+
+#include "MessageType.h"
+
+
+typedef unsigned long TransactionId;
+
+// transactions are unique process wide
+// since a few sessions can share the same connection
+TransactionId NextTransaction() noexcept;
+bool ParseTransaction(const char*, TransactionId*) noexcept;
+
+// Fixed size table of requests waiting for Janus reply
+class TransactionTable
+{
+public:
+    enum {
+        CAPACITY = 32,
+    };
+
+    // returns false if table is full
+    bool add(TransactionId, MessageType, gint64 now, gint64 timeout) noexcept;
+    bool contains(TransactionId) const noexcept;
+    bool find(TransactionId, MessageType*) const noexcept;
+    void remove(TransactionId) noexcept;
+    void clear() noexcept;
+
+    // returns true and the first expired transaction, if any
+    bool expired(
+        gint64 now,
+        TransactionId*,
+        MessageType*,
+        gint64* sentTime) const noexcept;
+
+private:
+    struct Entry
+    {
+        TransactionId id = 0; // 0 - free slot
+        MessageType type;
+        gint64 sentTime;
+        gint64 deadline;
+    };
+
+    const Entry* lookup(TransactionId) const noexcept;
+
+private:
+    std::array<Entry, CAPACITY> _entries;
+};
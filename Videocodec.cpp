@@ -0,0 +1,68 @@
+#include "Videocodec.h"
+
+#include <algorithm>
+
+#include <glib.h>
+
+
+bool ParseVideocodec(const char* name, GstRtStreaming::Videocodec* videocodec) noexcept
+{
+    if(!name)
+        return false;
+
+    if(0 == g_ascii_strcasecmp(name, "h264"))
+        *videocodec = GstRtStreaming::Videocodec::h264;
+    else if(0 == g_ascii_strcasecmp(name, "vp8"))
+        *videocodec = GstRtStreaming::Videocodec::vp8;
+    else
+        return false;
+
+    return true;
+}
+
+const char* VideocodecName(GstRtStreaming::Videocodec videocodec) noexcept
+{
+    switch(videocodec) {
+    case GstRtStreaming::Videocodec::h264:
+        return "h264";
+    case GstRtStreaming::Videocodec::vp8:
+        return "vp8";
+    default:
+        return "unknown";
+    }
+}
+
+Videocodecs ParseVideocodecs(const std::string& list) noexcept
+{
+    Videocodecs videocodecs;
+
+    std::string::size_type begin = 0;
+    while(begin < list.size()) {
+        std::string::size_type end = list.find(',', begin);
+        if(end == std::string::npos)
+            end = list.size();
+
+        const std::string name = list.substr(begin, end - begin);
+        GstRtStreaming::Videocodec videocodec;
+        if(ParseVideocodec(name.c_str(), &videocodec) && !IsAllowed(videocodec, videocodecs))
+            videocodecs.push_back(videocodec);
+
+        begin = end + 1;
+    }
+
+    return videocodecs;
+}
+
+bool IsAllowed(GstRtStreaming::Videocodec videocodec, const Videocodecs& allowed) noexcept
+{
+    return std::find(allowed.begin(), allowed.end(), videocodec) != allowed.end();
+}
+
+GstRtStreaming::Videocodec
+ChooseVideocodec(GstRtStreaming::Videocodec preferred, const Videocodecs& allowed) noexcept
+{
+    if(allowed.empty() || IsAllowed(preferred, allowed))
+        return preferred;
+
+    return allowed.front();
+}
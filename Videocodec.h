@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "RtStreaming/GstRtStreaming/Types.h"
+
+
+typedef std::vector<GstRtStreaming::Videocodec> Videocodecs;
+
+// accepts names used by Janus ("h264", "vp8") and RTP "encoding-name"
+bool ParseVideocodec(const char* name, GstRtStreaming::Videocodec*) noexcept;
+const char* VideocodecName(GstRtStreaming::Videocodec) noexcept;
+
+// parses Janus room "videocodec" list (like "vp8,h264"), unsupported codecs are skipped
+Videocodecs ParseVideocodecs(const std::string& list) noexcept;
+
+bool IsAllowed(GstRtStreaming::Videocodec, const Videocodecs& allowed) noexcept;
+
+// returns preferred codec if it's allowed (or nothing is known about allowed codecs),
+// most preferred allowed codec otherwise
+GstRtStreaming::Videocodec
+ChooseVideocodec(GstRtStreaming::Videocodec preferred, const Videocodecs& allowed) noexcept;
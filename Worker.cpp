@@ -0,0 +1,85 @@
+#include "Worker.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Log.h"
+
+
+namespace {
+
+const auto Log = ClientLog;
+
+}
+
+void QuitLoop(GMainLoop* loop) noexcept
+{
+    GSource* idleSource = g_idle_source_new();
+    g_source_set_callback(idleSource,
+        [] (gpointer userData) -> gboolean {
+            g_main_loop_quit(static_cast<GMainLoop*>(userData));
+            return FALSE;
+        },
+        g_main_loop_ref(loop),
+        reinterpret_cast<GDestroyNotify>(g_main_loop_unref));
+    g_source_attach(idleSource, g_main_loop_get_context(loop));
+    g_source_unref(idleSource);
+}
+
+Worker::Worker(unsigned index, int cpu, const Run& run) noexcept :
+    _index(index), _cpu(cpu), _run(run)
+{
+    GMainContext* context = g_main_context_new();
+    _loopPtr.reset(g_main_loop_new(context, FALSE));
+    g_main_context_unref(context);
+}
+
+Worker::~Worker()
+{
+    if(_thread.joinable()) {
+        QuitLoop(_loopPtr.get());
+        _thread.join();
+    }
+}
+
+void Worker::start() noexcept
+{
+    _thread = std::thread(&Worker::threadMain, this);
+
+    if(_cpu < 0)
+        return;
+
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(_cpu, &cpuSet);
+    if(0 != pthread_setaffinity_np(_thread.native_handle(), sizeof(cpuSet), &cpuSet))
+        Log()->warn("Fail set CPU affinity of worker #{} to CPU #{}", _index, _cpu);
+#else
+    Log()->warn("CPU affinity is not supported on this platform");
+#endif
+}
+
+void Worker::join() noexcept
+{
+    if(_thread.joinable())
+        _thread.join();
+}
+
+void Worker::threadMain() noexcept
+{
+    GMainLoop* loop = _loopPtr.get();
+    GMainContext* context = g_main_loop_get_context(loop);
+
+    g_main_context_push_thread_default(context);
+
+    Log()->info("Worker #{} started", _index);
+
+    _run(loop);
+
+    Log()->info("Worker #{} finished", _index);
+
+    g_main_context_pop_thread_default(context);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <thread>
+#include <functional>
+
+#include <glib.h>
+
+#include "CxxPtr/GlibPtr.h"
+
+
+// quits loop from it's own context,
+// so it works from any thread and even if loop is not running yet
+void QuitLoop(GMainLoop*) noexcept;
+
+// Thread with own GMainContext (pushed as thread default) and GMainLoop
+class Worker
+{
+public:
+    typedef std::function<void (GMainLoop*) noexcept> Run;
+
+    // cpu < 0 means no CPU affinity
+    Worker(unsigned index, int cpu, const Run&) noexcept;
+    ~Worker();
+
+    void start() noexcept;
+    void join() noexcept;
+
+private:
+    void threadMain() noexcept;
+
+private:
+    const unsigned _index;
+    const int _cpu;
+    const Run _run;
+
+    GMainLoopPtr _loopPtr;
+    std::thread _thread;
+};
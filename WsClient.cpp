@@ -1,6 +1,7 @@
 #include "WsClient.h"
 
 #include <deque>
+#include <vector>
 #include <algorithm>
 #include <map>
 
@@ -8,16 +9,20 @@
 #include "CxxPtr/JanssonPtr.h"
 #include "CxxPtr/GlibPtr.h"
 
-#include "Helpers/MessageBuffer.h"
-
+#include "MessageWriter.h"
+#include "ReceiveBuffer.h"
 #include "Log.h"
 
 
 namespace {
 
 enum {
-    RX_BUFFER_SIZE = 512,
+    RX_BUFFER_SIZE = 4096,
     PING_INTERVAL = 20,
+    MAX_SPARE_BUFFERS = 4,
+    MAX_SPARE_BUFFER_CAPACITY = 16 * 1024,
+    MAX_QUEUED_MESSAGES_PER_STREAM = 32,
+    MAX_WRITES_PER_CALLBACK = 16,
 };
 
 enum {
@@ -30,20 +35,35 @@ enum {
 };
 #endif
 
-struct SessionData
+struct OutgoingMessage
+{
+    unsigned streamIndex;
+    bool keepalive;
+    MessageWriter::Buffer buffer;
+};
+
+struct StreamData
 {
+    bool connectRequested = false;
     bool terminateSession = false;
-    MessageBuffer incomingMessage;
-    std::deque<MessageBuffer> sendMessages;
+    bool suspended = false; // session survived disconnect and waits for reconnect
+    unsigned queuedMessages = 0; // in connection send queue
     std::unique_ptr<Session> session;
 };
 
-// Should contain only POD types,
-// since created inside libwebsockets on session create.
-struct SessionContextData
+// Handed to libwebsockets as connection user data.
+// Every connection serves all streams from it's "streams" list.
+struct ConnectionData
 {
-    lws* wsi;
-    SessionData* data;
+    std::string url;
+    lws* wsi = nullptr;
+    bool established = false;
+    ReceiveBuffer incomingMessage;
+    std::deque<OutgoingMessage> sendMessages;
+    std::vector<MessageWriter::Buffer> spareBuffers; // already sent, kept for reuse
+
+    std::vector<unsigned> streams;
+    std::map<json_int_t, unsigned> janusSessions; // Janus session id -> stream index
 };
 
 const auto Log = ClientLog;
@@ -55,26 +75,39 @@ struct WsClient::Private
     Private(
         WsClient*,
         const Config&,
+        const std::vector<unsigned>& streams,
         GMainLoop*,
         const CreateSession&,
+        const Connected&,
         const Disconnected&);
 
     bool init();
     int httpCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
     int wsCallback(lws*, lws_callback_reasons, void* user, void* in, size_t len);
-    bool onMessage(SessionContextData*, const MessageBuffer&);
+    bool onMessage(ConnectionData*, const ReceiveBuffer&);
+    bool route(ConnectionData*, const JanusFrame&, unsigned* streamIndex);
 
-    void send(SessionContextData*, MessageBuffer*);
-    void sendMessage(SessionContextData*, const char* message);
+    bool send(ConnectionData*, unsigned streamIndex, MessageWriter::Buffer*, bool keepalive);
+    bool sendMessage(unsigned streamIndex, MessageWriter::Buffer* message, bool keepalive);
+    void recycle(ConnectionData*, MessageWriter::Buffer*);
 
-    void connect();
-    bool onConnected(SessionContextData*);
+    ConnectionData* connectionOf(unsigned streamIndex);
+
+    void connect(unsigned streamIndex);
+    void connect(ConnectionData*);
+    bool onConnected(ConnectionData*);
+    bool startSession(unsigned streamIndex);
+    void terminateSession(unsigned streamIndex);
+    bool onWriteable(ConnectionData*);
+    void onDisconnected(ConnectionData*);
 
 
     WsClient *const owner;
     Config config;
+    const std::vector<unsigned> clientStreams;
     GMainLoop* loop = nullptr;
     CreateSession createSession;
+    Connected connected;
     Disconnected disconnected;
 
 #if !defined(LWS_WITH_GLIB)
@@ -82,18 +115,21 @@ struct WsClient::Private
 #endif
     LwsContextPtr contextPtr;
 
-    lws* connection = nullptr;
-    bool connected = false;
+    std::vector<StreamData> streams;
+    std::deque<ConnectionData> connections;
+    std::vector<ConnectionData*> streamConnections;
 };
 
 WsClient::Private::Private(
     WsClient* owner,
     const Config& config,
+    const std::vector<unsigned>& streams,
     GMainLoop* loop,
     const WsClient::CreateSession& createSession,
+    const Connected& connected,
     const Disconnected& disconnected) :
-    owner(owner), config(config), loop(loop),
-    createSession(createSession), disconnected(disconnected)
+    owner(owner), config(config), clientStreams(streams), loop(loop),
+    createSession(createSession), connected(connected), disconnected(disconnected)
 {
 }
 
@@ -103,7 +139,7 @@ int WsClient::Private::wsCallback(
     void* user,
     void* in, size_t len)
 {
-    SessionContextData* scd = static_cast<SessionContextData*>(user);
+    ConnectionData* cd = static_cast<ConnectionData*>(user);
     switch(reason) {
 #if !defined(LWS_WITH_GLIB)
         case LWS_CALLBACK_ADD_POLL_FD:
@@ -112,29 +148,14 @@ int WsClient::Private::wsCallback(
             return LwsSourceCallback(lwsSourcePtr, wsi, reason, in, len);
 #endif
         case LWS_CALLBACK_CLIENT_ESTABLISHED: {
-            Log()->info("Connection to server established.");
-
-            std::unique_ptr<Session> session =
-                createSession(
-                    std::bind(
-                        &Private::sendMessage,
-                        this,
-                        scd,
-                        std::placeholders::_1));
-            if(!session)
-                return -1;
+            Log()->info(
+                "Connection to server established. Streams on connection: {}",
+                cd->streams.size());
 
-            scd->data =
-                new SessionData {
-                    .terminateSession = false,
-                    .incomingMessage ={},
-                    .sendMessages = {},
-                    .session = std::move(session)};
-            scd->wsi = wsi;
+            cd->wsi = wsi;
+            cd->established = true;
 
-            connected = true;
-
-            if(!onConnected(scd))
+            if(!onConnected(cd))
                 return -1;
 
             break;
@@ -143,67 +164,51 @@ int WsClient::Private::wsCallback(
             Log()->trace("PONG");
             break;
         case LWS_CALLBACK_CLIENT_RECEIVE:
-            if(scd->data->incomingMessage.onReceive(wsi, in, len)) {
+            if(cd->incomingMessage.onReceive(wsi, in, len)) {
                 if(Log()->level() <= spdlog::level::trace) {
                     std::string logMessage;
-                    logMessage.reserve(scd->data->incomingMessage.size());
+                    logMessage.reserve(cd->incomingMessage.size());
                     std::remove_copy(
-                        scd->data->incomingMessage.data(),
-                        scd->data->incomingMessage.data() + scd->data->incomingMessage.size(),
+                        cd->incomingMessage.data(),
+                        cd->incomingMessage.data() + cd->incomingMessage.size(),
                         std::back_inserter(logMessage), '\r');
 
                     Log()->trace("-> WsClient: {}", logMessage);
                 }
 
-                if(!onMessage(scd, scd->data->incomingMessage))
+                const gint64 processStart =
+                    Log()->level() <= spdlog::level::trace ? g_get_monotonic_time() : 0;
+
+                if(!onMessage(cd, cd->incomingMessage))
                     return -1;
 
-                scd->data->incomingMessage.clear();
+                if(processStart) {
+                    Log()->trace(
+                        "Message of {} bytes ({} fragments) processed in {} us",
+                        cd->incomingMessage.size(),
+                        cd->incomingMessage.fragments(),
+                        g_get_monotonic_time() - processStart);
+                }
+
+                cd->incomingMessage.clear();
             }
 
             break;
         case LWS_CALLBACK_CLIENT_WRITEABLE:
-            if(scd->data->terminateSession)
+            if(!onWriteable(cd))
                 return -1;
 
-            if(!scd->data->sendMessages.empty()) {
-                MessageBuffer& buffer = scd->data->sendMessages.front();
-                if(!buffer.writeAsText(wsi)) {
-                    Log()->error("Write failed.");
-                    return -1;
-                }
-
-                scd->data->sendMessages.pop_front();
-
-                if(!scd->data->sendMessages.empty())
-                    lws_callback_on_writable(wsi);
-            }
-
             break;
         case LWS_CALLBACK_CLIENT_CLOSED:
             Log()->info("Connection to server is closed.");
 
-            delete scd->data;
-            scd = nullptr;
-
-            connection = nullptr;
-            connected = false;
-
-            if(disconnected)
-                disconnected();
+            onDisconnected(cd);
 
             break;
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
             Log()->error("Can not connect to server.");
 
-            delete scd->data;
-            scd = nullptr;
-
-            connection = nullptr;
-            connected = false;
-
-            if(disconnected)
-                disconnected();
+            onDisconnected(cd);
 
             break;
         default:
@@ -227,7 +232,8 @@ bool WsClient::Private::init()
         {
             "janus-protocol",
             WsCallback,
-            sizeof(SessionContextData),
+            0, // ConnectionData is allocated by WsClient itself
+
             RX_BUFFER_SIZE,
             PROTOCOL_ID,
             nullptr
@@ -267,15 +273,73 @@ bool WsClient::Private::init()
         return false;
 #endif
 
+    streams.resize(config.streams.size());
+    streamConnections.resize(config.streams.size(), nullptr);
+
+    for(unsigned streamIndex: clientStreams) {
+        if(streamIndex >= streams.size())
+            continue;
+
+        const StreamConfig& streamConfig = config.streams[streamIndex];
+        const std::string& url =
+            streamConfig.janusUrl.empty() ?
+                config.janusUrl :
+                streamConfig.janusUrl;
+
+        ConnectionData* connection = nullptr;
+        if(config.shareConnection) {
+            auto it = std::find_if(
+                connections.begin(), connections.end(),
+                [&url] (const ConnectionData& connection) {
+                    return connection.url == url;
+                });
+            if(it != connections.end())
+                connection = &(*it);
+        }
+
+        if(!connection) {
+            connections.emplace_back();
+            connection = &connections.back();
+            connection->url = url;
+        }
+
+        connection->streams.push_back(streamIndex);
+        streamConnections[streamIndex] = connection;
+    }
+
     return true;
 }
 
-void WsClient::Private::connect()
+ConnectionData* WsClient::Private::connectionOf(unsigned streamIndex)
+{
+    return streamConnections[streamIndex];
+}
+
+void WsClient::Private::connect(unsigned streamIndex)
+{
+    if(streamIndex >= streams.size() || !connectionOf(streamIndex))
+        return;
+
+    StreamData& stream = streams[streamIndex];
+    if(stream.session && !stream.suspended)
+        return;
+
+    stream.connectRequested = true;
+
+    ConnectionData* cd = connectionOf(streamIndex);
+    if(cd->established) {
+        if(!startSession(streamIndex))
+            terminateSession(streamIndex);
+    } else
+        connect(cd);
+}
+
+void WsClient::Private::connect(ConnectionData* cd)
 {
-    if(connection)
+    if(cd->wsi)
         return;
 
-    if(config.janusUrl.empty()) {
+    if(cd->url.empty()) {
         Log()->error("Missing Janus URL.");
         return;
     }
@@ -283,8 +347,8 @@ void WsClient::Private::connect()
     bool useSecureConnection = true;
 
     std::vector<char> urlBuffer;
-    urlBuffer.reserve(config.janusUrl.size() + 1);
-    urlBuffer.assign(config.janusUrl.begin(), config.janusUrl.end());
+    urlBuffer.reserve(cd->url.size() + 1);
+    urlBuffer.assign(cd->url.begin(), cd->url.end());
     urlBuffer.push_back('\0');
 
     const char* prot;
@@ -315,7 +379,7 @@ void WsClient::Private::connect()
             port = 80;
     }
 
-    Log()->info("Connecting to {}...", config.janusUrl);
+    Log()->info("Connecting to {}...", cd->url);
 
     struct lws_client_connect_info connectInfo = {};
     connectInfo.context = contextPtr.get();
@@ -327,73 +391,327 @@ void WsClient::Private::connect()
     if(useSecureConnection)
         connectInfo.ssl_connection = LCCSCF_USE_SSL;
     connectInfo.protocol = "janus-protocol";
+    connectInfo.userdata = cd;
+    connectInfo.pwsi = &cd->wsi;
+
+    lws_client_connect_via_info(&connectInfo);
+}
+
+bool WsClient::Private::onConnected(ConnectionData* cd)
+{
+    for(unsigned streamIndex: cd->streams) {
+        if(!streams[streamIndex].connectRequested)
+            continue;
+
+        if(!startSession(streamIndex)) {
+            if(cd->streams.size() == 1)
+                return false;
+
+            terminateSession(streamIndex);
+        }
+    }
+
+    return true;
+}
+
+bool WsClient::Private::startSession(unsigned streamIndex)
+{
+    StreamData& stream = streams[streamIndex];
+
+    // connection of stream is established at this point
+    if(connected)
+        connected(streamIndex);
+
+    if(stream.terminateSession)
+        stream.session.reset();
+
+    stream.connectRequested = false;
+    stream.terminateSession = false;
+
+    if(stream.session && stream.suspended) {
+        stream.suspended = false;
+        return stream.session->resume();
+    }
 
-    connection = lws_client_connect_via_info(&connectInfo);
-    connected = false;
+    stream.suspended = false;
+    stream.session =
+        createSession(
+            streamIndex,
+            std::bind(
+                &Private::sendMessage,
+                this,
+                streamIndex,
+                std::placeholders::_1,
+                std::placeholders::_2));
+    if(!stream.session)
+        return false;
+
+    return stream.session->onConnected();
 }
 
-bool WsClient::Private::onConnected(SessionContextData* scd)
+void WsClient::Private::terminateSession(unsigned streamIndex)
 {
-    return scd->data->session->onConnected();
+    streams[streamIndex].terminateSession = true;
+
+    ConnectionData* cd = connectionOf(streamIndex);
+    if(cd->wsi)
+        lws_callback_on_writable(cd->wsi);
+}
+
+bool WsClient::Private::onWriteable(ConnectionData* cd)
+{
+    for(unsigned streamIndex: cd->streams) {
+        StreamData& stream = streams[streamIndex];
+        if(!stream.terminateSession)
+            continue;
+
+        // dedicated connection is closed together with it's session
+        if(cd->streams.size() == 1)
+            return false;
+
+        Log()->info("Terminating session of stream #{}...", streamIndex);
+
+        stream.terminateSession = false;
+        stream.session.reset();
+
+        if(disconnected)
+            disconnected(streamIndex);
+    }
+
+    // drain as much as socket accepts without blocking
+    unsigned writes = 0;
+    while(!cd->sendMessages.empty() &&
+          writes < MAX_WRITES_PER_CALLBACK &&
+          !lws_send_pipe_choked(cd->wsi))
+    {
+        MessageWriter::Buffer& buffer = cd->sendMessages.front().buffer;
+        const size_t size = buffer.size() - LWS_PRE;
+        const int written =
+            lws_write(
+                cd->wsi,
+                reinterpret_cast<unsigned char*>(buffer.data() + LWS_PRE),
+                size,
+                LWS_WRITE_TEXT);
+        if(written < 0 || static_cast<size_t>(written) < size) {
+            Log()->error("Write failed.");
+            return false;
+        }
+
+        --streams[cd->sendMessages.front().streamIndex].queuedMessages;
+        recycle(cd, &buffer);
+        cd->sendMessages.pop_front();
+        ++writes;
+    }
+
+    if(!cd->sendMessages.empty())
+        lws_callback_on_writable(cd->wsi);
+
+    return true;
+}
+
+void WsClient::Private::onDisconnected(ConnectionData* cd)
+{
+    cd->wsi = nullptr;
+    cd->established = false;
+    cd->incomingMessage.reset();
+    cd->sendMessages.clear();
+    cd->spareBuffers.clear();
+    cd->janusSessions.clear();
+
+    for(unsigned streamIndex: cd->streams) {
+        StreamData& stream = streams[streamIndex];
+        stream.queuedMessages = 0;
+        if(!stream.session && !stream.connectRequested)
+            continue;
+
+        // already suspended session stays so until it's claimed or fails
+        const bool suspend =
+            config.resumeSession &&
+            stream.session &&
+            !stream.terminateSession &&
+            (stream.suspended || stream.session->suspend());
+
+        stream.connectRequested = false;
+        stream.terminateSession = false;
+        if(!suspend)
+            stream.session.reset();
+        else if(!stream.suspended)
+            Log()->info("Session of stream #{} is suspended until reconnect", streamIndex);
+        stream.suspended = suspend;
+
+        if(disconnected)
+            disconnected(streamIndex);
+    }
+}
+
+bool WsClient::Private::route(
+    ConnectionData* cd,
+    const JanusFrame& frame,
+    unsigned* streamIndex)
+{
+    if(cd->streams.size() == 1) {
+        *streamIndex = cd->streams.front();
+        return streams[*streamIndex].session != nullptr;
+    }
+
+    if(frame.hasSession()) {
+        const json_int_t janusSession = frame.session();
+
+        const auto it = cd->janusSessions.find(janusSession);
+        if(it != cd->janusSessions.end()) {
+            const std::unique_ptr<Session>& session = streams[it->second].session;
+            if(session && session->janusSession() == janusSession) {
+                *streamIndex = it->second;
+                return true;
+            }
+
+            cd->janusSessions.erase(it);
+        }
+
+        for(unsigned index: cd->streams) {
+            const std::unique_ptr<Session>& session = streams[index].session;
+            if(session && session->janusSession() == janusSession) {
+                cd->janusSessions.emplace(janusSession, index);
+                *streamIndex = index;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    if(const TransactionId transaction = frame.transaction()) {
+        for(unsigned index: cd->streams) {
+            const std::unique_ptr<Session>& session = streams[index].session;
+            if(session && session->isTransactionPending(transaction)) {
+                *streamIndex = index;
+                return true;
+            }
+        }
+    }
+
+    return false;
 }
 
 bool WsClient::Private::onMessage(
-    SessionContextData* scd,
-    const MessageBuffer& message)
+    ConnectionData* cd,
+    const ReceiveBuffer& message)
 {
-    json_error_t jsonError;
-    JsonPtr jsonMessage(json_loadb(message.data(), message.size(), 0, &jsonError));
-    if(!jsonMessage)
+    JanusFrame frame(message.data(), message.size());
+    if(!frame.parse())
         return false;
 
-    if(!scd->data->session->handleMessage(jsonMessage)) {
+    unsigned streamIndex;
+    if(!route(cd, frame, &streamIndex)) {
+        if(cd->streams.size() == 1)
+            return false;
+
+        Log()->debug("Got message for unknown session. Ignoring...");
+        return true;
+    }
+
+    if(!streams[streamIndex].session->handleMessage(&frame)) {
         Log()->debug("Fail handle message. Forcing session disconnect...");
-        return false;
+
+        if(cd->streams.size() == 1)
+            return false;
+
+        terminateSession(streamIndex);
     }
 
     return true;
 }
 
-void WsClient::Private::send(SessionContextData* scd, MessageBuffer* message)
+void WsClient::Private::recycle(ConnectionData* cd, MessageWriter::Buffer* buffer)
 {
-    assert(!message->empty());
+    if(cd->spareBuffers.size() < MAX_SPARE_BUFFERS &&
+       buffer->capacity() <= MAX_SPARE_BUFFER_CAPACITY)
+    {
+        cd->spareBuffers.emplace_back(std::move(*buffer));
+    }
+}
+
+// takes message content and leaves recycled buffer in it's place
+bool WsClient::Private::send(
+    ConnectionData* cd,
+    unsigned streamIndex,
+    MessageWriter::Buffer* message,
+    bool keepalive)
+{
+    assert(message->size() > LWS_PRE);
 
-    scd->data->sendMessages.emplace_back(std::move(*message));
+    if(!cd->established)
+        return false;
 
-    lws_callback_on_writable(scd->wsi);
+    if(keepalive) {
+        // it's enough to have single pending keepalive per stream
+        for(const OutgoingMessage& queued: cd->sendMessages) {
+            if(queued.keepalive && queued.streamIndex == streamIndex) {
+                Log()->debug("Keepalive of stream #{} is already queued. Skipping...", streamIndex);
+                return false;
+            }
+        }
+    }
+
+    // connection is shared, so only stream which floods it is punished
+    StreamData& stream = streams[streamIndex];
+    if(stream.queuedMessages >= MAX_QUEUED_MESSAGES_PER_STREAM) {
+        if(keepalive) {
+            Log()->debug("Send queue is full. Dropping keepalive of stream #{}...", streamIndex);
+            return false;
+        }
+
+        Log()->error(
+            "Send queue is full. Forcing session disconnect of stream #{}...",
+            streamIndex);
+        terminateSession(streamIndex);
+        return false;
+    }
+
+    cd->sendMessages.emplace_back();
+    OutgoingMessage& outgoing = cd->sendMessages.back();
+    outgoing.streamIndex = streamIndex;
+    outgoing.keepalive = keepalive;
+    outgoing.buffer.swap(*message);
+    ++stream.queuedMessages;
+
+    if(!cd->spareBuffers.empty()) {
+        message->swap(cd->spareBuffers.back());
+        cd->spareBuffers.pop_back();
+    }
+
+    lws_callback_on_writable(cd->wsi);
+
+    return true;
 }
 
-void WsClient::Private::sendMessage(
-    SessionContextData* scd,
-    const char* message)
+bool WsClient::Private::sendMessage(
+    unsigned streamIndex,
+    MessageWriter::Buffer* message,
+    bool keepalive)
 {
     if(!message) {
-        scd->data->terminateSession = true;
-        lws_callback_on_writable(scd->wsi);
-        return;
+        terminateSession(streamIndex);
+        return false;
     }
 
     if(Log()->level() <= spdlog::level::trace) {
-        std::string logMessage;
-        for(const char* c = message; *c != '\0'; ++c) {
-            if(*c != '\r')
-                logMessage.push_back(*c);
-        }
-
-        Log()->trace("WsClient -> : {}", logMessage);
+        Log()->trace(
+            "WsClient -> : {}",
+            std::string(message->data() + LWS_PRE, message->size() - LWS_PRE));
     }
 
-    MessageBuffer requestMessage;
-    requestMessage.assign(message);
-    send(scd, &requestMessage);
+    return send(connectionOf(streamIndex), streamIndex, message, keepalive);
 }
 
 WsClient::WsClient(
     const Config& config,
+    const std::vector<unsigned>& streams,
     GMainLoop* loop,
     const CreateSession& createSession,
+    const Connected& connected,
     const Disconnected& disconnected) noexcept:
-    _p(std::make_unique<Private>(this, config, loop, createSession, disconnected))
+    _p(std::make_unique<Private>(this, config, streams, loop, createSession, connected, disconnected))
 {
 }
 
@@ -406,7 +724,7 @@ bool WsClient::init() noexcept
     return _p->init();
 }
 
-void WsClient::connect() noexcept
+void WsClient::connect(unsigned streamIndex) noexcept
 {
-    _p->connect();
+    _p->connect(streamIndex);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <memory>
 #include <functional>
 
@@ -15,19 +16,25 @@ class WsClient
 public:
     typedef std::function<
         std::unique_ptr<Session> (
-            const std::function<void (const char*) noexcept>& sendMessage) noexcept> CreateSession;
+            unsigned streamIndex,
+            const std::function<bool (MessageWriter::Buffer*, bool keepalive) noexcept>& sendMessage) noexcept> CreateSession;
 
-    typedef std::function<void () noexcept> Disconnected;
+    // connection of stream is established
+    typedef std::function<void (unsigned streamIndex) noexcept> Connected;
+    typedef std::function<void (unsigned streamIndex) noexcept> Disconnected;
 
+    // serves only streams with indices from "streams"
     WsClient(
         const Config&,
+        const std::vector<unsigned>& streams,
         GMainLoop*,
         const CreateSession&,
+        const Connected&,
         const Disconnected&) noexcept;
     bool init() noexcept;
     ~WsClient();
 
-    void connect() noexcept;
+    void connect(unsigned streamIndex) noexcept;
 
 private:
     struct Private;
@@ -1,4 +1,9 @@
 #include <deque>
+#include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 #include <CxxPtr/CPtr.h>
 #include <CxxPtr/GlibPtr.h>
@@ -15,14 +20,148 @@
 #include "Log.h"
 #include "Config.h"
 #include "WsClient.h"
+#include "SharedSource.h"
+#include "Worker.h"
+#include "Supervisor.h"
+#include "HandshakeLimit.h"
+#include "CpuGovernor.h"
+#include "RoomInfo.h"
 
 
 enum {
     DEFAULT_RECONNECT_TIMEOUT = 5,
+    DEFAULT_MAX_RECONNECT_TIMEOUT = 60,
+    HEARTBEAT_INTERVAL = 5,
 };
 
 static const auto Log = ClientLog;
 
+static void LoadStreamerConfig(
+    const config_setting_t* streamerConfig,
+    StreamerConfig* loadedConfig)
+{
+    const char* test = nullptr;
+    if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "test", &test)) {
+        loadedConfig->type = StreamerConfig::Type::Test;
+        loadedConfig->source = test;
+    }
+
+    const char* videocodec = nullptr;
+    if(config_setting_lookup_string(streamerConfig, "videocodec", &videocodec)) {
+        ParseVideocodec(videocodec, &loadedConfig->videocodec);
+    }
+
+    const char* pipeline = nullptr;
+    if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "pipeline", &pipeline)) {
+        loadedConfig->type = StreamerConfig::Type::Pipeline;
+        loadedConfig->source = pipeline;
+    }
+
+    const char* url = nullptr;
+    if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "url", &url)) {
+        loadedConfig->type = StreamerConfig::Type::ReStreamer;
+        loadedConfig->source = url;
+    }
+
+    int standbyTimeout = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "standby-timeout", &standbyTimeout)) {
+        loadedConfig->standbyTimeout = static_cast<unsigned>(std::max(standbyTimeout, 0));
+    }
+
+    int gopCache = CONFIG_FALSE;
+    if(CONFIG_TRUE == config_setting_lookup_bool(streamerConfig, "gop-cache", &gopCache)) {
+        loadedConfig->gopCache = gopCache != CONFIG_FALSE;
+    }
+
+    int minBitrate = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "min-bitrate", &minBitrate)) {
+        loadedConfig->minBitrate = static_cast<unsigned>(std::max(minBitrate, 0));
+    }
+    int maxBitrate = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "max-bitrate", &maxBitrate)) {
+        loadedConfig->maxBitrate = static_cast<unsigned>(std::max(maxBitrate, 0));
+    }
+
+    int priority = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "priority", &priority)) {
+        loadedConfig->priority = priority;
+    }
+
+    double pacingFactor = 0;
+    int intPacingFactor = 0;
+    if(CONFIG_TRUE == config_setting_lookup_float(streamerConfig, "pacing-factor", &pacingFactor)) {
+        loadedConfig->pacingFactor = std::max(pacingFactor, 0.0);
+    } else if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "pacing-factor", &intPacingFactor)) {
+        loadedConfig->pacingFactor = std::max(intPacingFactor, 0);
+    }
+    int pacingMaxDelay = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "pacing-max-delay", &pacingMaxDelay)) {
+        loadedConfig->pacingMaxDelay = static_cast<unsigned>(std::max(pacingMaxDelay, 0));
+    }
+
+    int rtx = CONFIG_FALSE;
+    if(CONFIG_TRUE == config_setting_lookup_bool(streamerConfig, "rtx", &rtx)) {
+        loadedConfig->rtx = rtx != CONFIG_FALSE;
+    }
+    int rtxBuffer = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "rtx-buffer", &rtxBuffer)) {
+        loadedConfig->rtxBuffer = static_cast<unsigned>(std::max(rtxBuffer, 0));
+    }
+    int fecPercentage = 0;
+    if(CONFIG_TRUE == config_setting_lookup_int(streamerConfig, "fec", &fecPercentage)) {
+        loadedConfig->fecPercentage = static_cast<unsigned>(std::min(std::max(fecPercentage, 0), 100));
+    }
+}
+
+// accepts both array and list of strings
+template<typename Container>
+static void LoadStrings(
+    const config_setting_t* parentConfig,
+    const char* name,
+    Container* strings)
+{
+    config_setting_t* stringsConfig = config_setting_get_member(parentConfig, name);
+    if(!stringsConfig ||
+       (CONFIG_FALSE == config_setting_is_array(stringsConfig) &&
+        CONFIG_FALSE == config_setting_is_list(stringsConfig)))
+    {
+        return;
+    }
+
+    strings->clear();
+
+    const int count = config_setting_length(stringsConfig);
+    for(int index = 0; index < count; ++index) {
+        const char* value = config_setting_get_string_elem(stringsConfig, index);
+        if(value)
+            strings->emplace_back(value);
+        else
+            Log()->warn("\"{}\" should contain only strings. Element skipped.", name);
+    }
+}
+
+// features available only with SharedSource
+static bool NeedsSharedSource(const Config& config, const StreamerConfig& streamer)
+{
+    switch(streamer.type) {
+    case StreamerConfig::Type::Pipeline:
+        // encoder named "encoder" can adapt bitrate
+        if(streamer.maxBitrate > 0)
+            return true;
+        break;
+    case StreamerConfig::Type::Test:
+        // only encoding source can adapt bitrate and be degraded by governor
+        if(streamer.maxBitrate > 0 || config.cpuGovernor.enabled)
+            return true;
+        break;
+    default:
+        break;
+    }
+
+    return streamer.standbyTimeout > 0 || streamer.gopCache || streamer.pacingFactor > 0 ||
+        streamer.rtx || streamer.fecPercentage > 0;
+}
+
 static bool LoadConfig(Config* config)
 {
     const std::deque<std::string> configDirs = ::ConfigDirs();
@@ -31,6 +170,10 @@ static bool LoadConfig(Config* config)
 
     Config loadedConfig = *config;
 
+    StreamConfig defaultStream;
+    std::deque<StreamConfig> loadedStreams;
+    bool streamsFound = false;
+
     bool someConfigFound = false;
     for(const std::string& configDir: configDirs) {
         const std::string configFile = configDir + "/janus-videoroom-streamer.conf";
@@ -65,45 +208,196 @@ static bool LoadConfig(Config* config)
             {
                 loadedConfig.cipherList = cipherList;
             }
+            int shareConnection = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(targetConfig, "share-connection", &shareConnection)) {
+                loadedConfig.shareConnection = shareConnection != CONFIG_FALSE;
+            }
             int timeout = 0;
             if(CONFIG_TRUE == config_setting_lookup_int(targetConfig, "reconnect-timeout", &timeout)) {
                 loadedConfig.reconnectTimeout = static_cast<unsigned>(timeout);
             }
+            int maxTimeout = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(targetConfig, "max-reconnect-timeout", &maxTimeout)) {
+                loadedConfig.maxReconnectTimeout = static_cast<unsigned>(maxTimeout);
+            }
+            int maxHandshakes = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(targetConfig, "max-handshakes", &maxHandshakes)) {
+                loadedConfig.maxHandshakes = static_cast<unsigned>(std::max(maxHandshakes, 0));
+            }
+            int resumeSession = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(targetConfig, "resume-session", &resumeSession)) {
+                loadedConfig.resumeSession = resumeSession != CONFIG_FALSE;
+            }
+            int trackParticipants = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(targetConfig, "track-participants", &trackParticipants)) {
+                loadedConfig.trackParticipants = trackParticipants != CONFIG_FALSE;
+            }
+            int fastStart = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(targetConfig, "fast-start", &fastStart)) {
+                loadedConfig.fastStart = fastStart != CONFIG_FALSE;
+            }
+            int negotiateVideocodec = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(targetConfig, "negotiate-videocodec", &negotiateVideocodec)) {
+                loadedConfig.negotiateVideocodec = negotiateVideocodec != CONFIG_FALSE;
+            }
+            int trickleBatchInterval = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(targetConfig, "trickle-batch-interval", &trickleBatchInterval)) {
+                loadedConfig.trickleBatchInterval =
+                    static_cast<unsigned>(std::max(trickleBatchInterval, 0));
+            }
             const char* display = nullptr;
             if(CONFIG_TRUE == config_setting_lookup_string(targetConfig, "display", &display)) {
-                loadedConfig.display = display;
+                defaultStream.display = display;
             }
             int room = 0;
             if(CONFIG_TRUE == config_setting_lookup_int(targetConfig, "room", &room)) {
-                loadedConfig.room = room;
+                defaultStream.room = room;
             }
         }
         config_setting_t* streamerConfig = config_lookup(&config, "streamer");
         if(streamerConfig && CONFIG_TRUE == config_setting_is_group(streamerConfig)) {
-            const char* test = nullptr;
-            if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "test", &test)) {
-                loadedConfig.streamer.type = StreamerConfig::Type::Test;
-                loadedConfig.streamer.source = test;
-            }
+            LoadStreamerConfig(streamerConfig, &defaultStream.streamer);
+        }
+        config_setting_t* sourcesConfig = config_lookup(&config, "sources");
+        if(sourcesConfig && CONFIG_TRUE == config_setting_is_group(sourcesConfig)) {
+            const int sourcesCount = config_setting_length(sourcesConfig);
+            for(int sourceIdx = 0; sourceIdx < sourcesCount; ++sourceIdx) {
+                config_setting_t* sourceConfig =
+                    config_setting_get_elem(sourcesConfig, sourceIdx);
+                if(!sourceConfig || CONFIG_FALSE == config_setting_is_group(sourceConfig)) {
+                    Log()->warn("Wrong source config format. Source skipped.");
+                    continue;
+                }
 
-            const char* videocodec = nullptr;
-            if(config_setting_lookup_string(streamerConfig, "videocodec", &videocodec)) {
-                if(0 == strcmp(videocodec, "h264"))
-                    loadedConfig.streamer.videocodec = GstRtStreaming::Videocodec::h264;
-                else if(0 == strcmp(videocodec, "vp8"))
-                    loadedConfig.streamer.videocodec = GstRtStreaming::Videocodec::vp8;
+                StreamerConfig source;
+                LoadStreamerConfig(sourceConfig, &source);
+                loadedConfig.sharedSources[config_setting_name(sourceConfig)] = source;
             }
+        }
+        config_setting_t* streamsConfig = config_lookup(&config, "streams");
+        if(streamsConfig && CONFIG_TRUE == config_setting_is_list(streamsConfig)) {
+            std::deque<StreamConfig> streams;
+
+            const int streamsCount = config_setting_length(streamsConfig);
+            for(int streamIdx = 0; streamIdx < streamsCount; ++streamIdx) {
+                config_setting_t* streamConfig =
+                    config_setting_get_elem(streamsConfig, streamIdx);
+                if(!streamConfig || CONFIG_FALSE == config_setting_is_group(streamConfig)) {
+                    Log()->warn("Wrong stream config format. Stream skipped.");
+                    continue;
+                }
+
+                StreamConfig stream = defaultStream;
 
-            const char* pipeline = nullptr;
-            if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "pipeline", &pipeline)) {
-                loadedConfig.streamer.type = StreamerConfig::Type::Pipeline;
-                loadedConfig.streamer.source = pipeline;
+                const char* janusUrl = nullptr;
+                if(CONFIG_TRUE == config_setting_lookup_string(streamConfig, "janus-url", &janusUrl)) {
+                    stream.janusUrl = janusUrl;
+                }
+                const char* display = nullptr;
+                if(CONFIG_TRUE == config_setting_lookup_string(streamConfig, "display", &display)) {
+                    stream.display = display;
+                }
+                int room = 0;
+                if(CONFIG_TRUE == config_setting_lookup_int(streamConfig, "room", &room)) {
+                    stream.room = room;
+                }
+
+                LoadStreamerConfig(streamConfig, &stream.streamer);
+
+                int worker = -1;
+                if(CONFIG_TRUE == config_setting_lookup_int(streamConfig, "worker", &worker)) {
+                    stream.worker = worker;
+                }
+
+                const char* sharedSource = nullptr;
+                if(CONFIG_TRUE == config_setting_lookup_string(streamConfig, "source", &sharedSource)) {
+                    stream.sharedSource = sharedSource;
+                }
+
+                streams.emplace_back(std::move(stream));
             }
 
-            const char* url = nullptr;
-            if(CONFIG_TRUE == config_setting_lookup_string(streamerConfig, "url", &url)) {
-                loadedConfig.streamer.type = StreamerConfig::Type::ReStreamer;
-                loadedConfig.streamer.source = url;
+            loadedStreams = std::move(streams);
+            streamsFound = true;
+        }
+        config_setting_t* workersConfig = config_lookup(&config, "workers");
+        if(workersConfig && CONFIG_TRUE == config_setting_is_group(workersConfig)) {
+            int count = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(workersConfig, "count", &count)) {
+                loadedConfig.workers = count > 0 ? static_cast<unsigned>(count) : 0;
+            }
+            int cpuAffinity = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(workersConfig, "cpu-affinity", &cpuAffinity)) {
+                loadedConfig.cpuAffinity = cpuAffinity != CONFIG_FALSE;
+            }
+        }
+        config_setting_t* iceConfig = config_lookup(&config, "ice");
+        if(iceConfig && CONFIG_TRUE == config_setting_is_group(iceConfig)) {
+            LoadStrings(iceConfig, "servers", &loadedConfig.iceServers);
+            const char* transportPolicy = nullptr;
+            if(CONFIG_TRUE == config_setting_lookup_string(iceConfig, "transport-policy", &transportPolicy)) {
+                if(0 == strcmp(transportPolicy, "all"))
+                    loadedConfig.ice.transportPolicy = IceConfig::TransportPolicy::All;
+                else if(0 == strcmp(transportPolicy, "relay"))
+                    loadedConfig.ice.transportPolicy = IceConfig::TransportPolicy::Relay;
+                else if(0 == strcmp(transportPolicy, "host"))
+                    loadedConfig.ice.transportPolicy = IceConfig::TransportPolicy::Host;
+                else
+                    Log()->warn("Unknown ICE transport policy \"{}\"", transportPolicy);
+            }
+            LoadStrings(iceConfig, "allow-interfaces", &loadedConfig.ice.allowedInterfaces);
+            LoadStrings(iceConfig, "deny-interfaces", &loadedConfig.ice.deniedInterfaces);
+            LoadStrings(iceConfig, "allow-addresses", &loadedConfig.ice.allowedAddresses);
+            LoadStrings(iceConfig, "deny-addresses", &loadedConfig.ice.deniedAddresses);
+            int gatherTimeout = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(iceConfig, "gather-timeout", &gatherTimeout)) {
+                loadedConfig.ice.gatherTimeout = static_cast<unsigned>(std::max(gatherTimeout, 0));
+            }
+        }
+        config_setting_t* governorConfig = config_lookup(&config, "cpu-governor");
+        if(governorConfig && CONFIG_TRUE == config_setting_is_group(governorConfig)) {
+            int enabled = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(governorConfig, "enabled", &enabled)) {
+                loadedConfig.cpuGovernor.enabled = enabled != CONFIG_FALSE;
+            }
+            int highLoad = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(governorConfig, "high-load", &highLoad)) {
+                if(highLoad > 0 && highLoad <= 100)
+                    loadedConfig.cpuGovernor.highLoad = static_cast<unsigned>(highLoad);
+            }
+            int lowLoad = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(governorConfig, "low-load", &lowLoad)) {
+                if(lowLoad >= 0 && lowLoad <= 100)
+                    loadedConfig.cpuGovernor.lowLoad = static_cast<unsigned>(lowLoad);
+            }
+            if(loadedConfig.cpuGovernor.lowLoad >= loadedConfig.cpuGovernor.highLoad) {
+                Log()->warn("\"cpu-governor.low-load\" should be less than \"high-load\"");
+                loadedConfig.cpuGovernor.lowLoad = loadedConfig.cpuGovernor.highLoad / 2;
+            }
+        }
+        config_setting_t* supervisorConfig = config_lookup(&config, "supervisor");
+        if(supervisorConfig && CONFIG_TRUE == config_setting_is_group(supervisorConfig)) {
+            int enabled = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(supervisorConfig, "enabled", &enabled)) {
+                loadedConfig.supervisor.enabled = enabled != CONFIG_FALSE;
+            }
+            int processes = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(supervisorConfig, "processes", &processes)) {
+                loadedConfig.supervisor.processes = processes > 0 ? static_cast<unsigned>(processes) : 0;
+            }
+            int cpuAffinity = CONFIG_FALSE;
+            if(CONFIG_TRUE == config_setting_lookup_bool(supervisorConfig, "cpu-affinity", &cpuAffinity)) {
+                loadedConfig.supervisor.cpuAffinity = cpuAffinity != CONFIG_FALSE;
+            }
+            int restartTimeout = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(supervisorConfig, "restart-timeout", &restartTimeout)) {
+                if(restartTimeout > 0)
+                    loadedConfig.supervisor.restartTimeout = static_cast<unsigned>(restartTimeout);
+            }
+            int maxRestartTimeout = 0;
+            if(CONFIG_TRUE == config_setting_lookup_int(supervisorConfig, "max-restart-timeout", &maxRestartTimeout)) {
+                if(maxRestartTimeout > 0)
+                    loadedConfig.supervisor.maxRestartTimeout = static_cast<unsigned>(maxRestartTimeout);
             }
         }
         config_setting_t* debugConfig = config_lookup(&config, "debug");
@@ -130,10 +424,55 @@ static bool LoadConfig(Config* config)
     if(!someConfigFound)
         return false;
 
+    if(streamsFound)
+        loadedConfig.streams = std::move(loadedStreams);
+    else
+        loadedConfig.streams.emplace_back(std::move(defaultStream));
+
+    // such streams get private source
+    for(unsigned streamIndex = 0; streamIndex < loadedConfig.streams.size(); ++streamIndex) {
+        StreamConfig& stream = loadedConfig.streams[streamIndex];
+        if(!stream.sharedSource.empty() || !NeedsSharedSource(loadedConfig, stream.streamer))
+            continue;
+
+        if(stream.streamer.type == StreamerConfig::Type::Pipeline) {
+            // has to end with "webrtcbin" in this case
+            Log()->warn(
+                "Stream #{}: \"pipeline\" streamer ignores options requiring shared source. "
+                "Move it to \"sources\" to use them.",
+                streamIndex);
+            continue;
+        }
+
+        // '#' is not allowed in config setting names, so there is no collisions
+        stream.sharedSource = "#stream-" + std::to_string(streamIndex);
+        loadedConfig.sharedSources[stream.sharedSource] = stream.streamer;
+    }
+
     bool success = true;
 
-    if(loadedConfig.janusUrl.empty()) {
-        Log()->error("Missing Janus URL");
+    for(const StreamConfig& stream: loadedConfig.streams) {
+        if(loadedConfig.janusUrl.empty() && stream.janusUrl.empty()) {
+            Log()->error("Missing Janus URL");
+            success = false;
+            break;
+        }
+    }
+
+    for(const StreamConfig& stream: loadedConfig.streams) {
+        if(stream.sharedSource.empty())
+            continue;
+
+        if(loadedConfig.sharedSources.find(stream.sharedSource) ==
+           loadedConfig.sharedSources.end())
+        {
+            Log()->error("Unknown source \"{}\"", stream.sharedSource);
+            success = false;
+        }
+    }
+
+    if(loadedConfig.streams.empty()) {
+        Log()->error("No streams configured");
         success = false;
     }
 
@@ -143,21 +482,34 @@ static bool LoadConfig(Config* config)
     return success;
 }
 
+typedef std::map<std::string, std::unique_ptr<SharedSource>> SharedSources;
+
 static std::unique_ptr<WebRTCPeer>
-CreatePeer(const Config* config)
+CreatePeer(
+    const SharedSources* sharedSources,
+    const StreamConfig* streamConfig,
+    const RoomInfo& room)
 {
-    switch(config->streamer.type) {
+    if(!streamConfig->sharedSource.empty()) {
+        auto it = sharedSources->find(streamConfig->sharedSource);
+        if(it != sharedSources->end())
+            return it->second->createPeer(room);
+    }
+
+    // "pipeline" and restreamed sources are published as is
+    const StreamerConfig& streamer = streamConfig->streamer;
+    switch(streamer.type) {
     case StreamerConfig::Type::Test:
         return
             std::make_unique<GstTestStreamer>(
-                config->streamer.source,
-                config->streamer.videocodec);
+                streamer.source,
+                ChooseVideocodec(streamer.videocodec, room.videocodecs));
     case StreamerConfig::Type::Pipeline:
         return
-            std::make_unique<GstPipelineStreamer>(config->streamer.source);
+            std::make_unique<GstPipelineStreamer>(streamer.source);
     case StreamerConfig::Type::ReStreamer:
         return
-            std::make_unique<GstReStreamer>(config->streamer.source);
+            std::make_unique<GstReStreamer>(streamer.source);
     default:
         return
             std::make_unique<GstTestStreamer>();
@@ -165,65 +517,333 @@ CreatePeer(const Config* config)
 }
 
 static std::unique_ptr<Session> CreateSession(
-    Config* config,
-    const std::function<void (const char*) noexcept>& sendMessage) noexcept
+    const Config* config,
+    const SharedSources* sharedSources,
+    unsigned streamIndex,
+    const std::function<bool (MessageWriter::Buffer*, bool keepalive) noexcept>& sendMessage) noexcept
 {
+    const StreamConfig* streamConfig = &config->streams[streamIndex];
+
     return
         std::make_unique<Session>(
             config,
-            std::bind(CreatePeer, config),
+            streamConfig,
+            std::bind(CreatePeer, sharedSources, streamConfig, std::placeholders::_1),
             sendMessage);
 }
 
+struct ReconnectState
+{
+    unsigned attempts = 0;
+    gint64 connectTime = 0; // when connection was established, 0 - it wasn't
+};
+
+struct ReconnectData
+{
+    WsClient* client;
+    unsigned streamIndex;
+};
+
+static void ClientConnected(
+    std::vector<ReconnectState>* reconnectStates,
+    unsigned streamIndex) noexcept
+{
+    (*reconnectStates)[streamIndex].connectTime = g_get_monotonic_time();
+}
+
+// exponential backoff with full jitter,
+// to not reconnect all streams at once after Janus restart
 static void ClientDisconnected(
     const Config* config,
-    WsClient* client) noexcept
+    WsClient* client,
+    std::vector<ReconnectState>* reconnectStates,
+    unsigned streamIndex) noexcept
 {
     const unsigned reconnectTimeout =
         config->reconnectTimeout > 0 ?
             config->reconnectTimeout :
             DEFAULT_RECONNECT_TIMEOUT;
+    const unsigned maxReconnectTimeout =
+        std::max(
+            config->maxReconnectTimeout > 0 ?
+                config->maxReconnectTimeout :
+                static_cast<unsigned>(DEFAULT_MAX_RECONNECT_TIMEOUT),
+            reconnectTimeout);
+
+    ReconnectState& state = (*reconnectStates)[streamIndex];
+
+    // connection lived long enough is considered successful
+    if(state.connectTime != 0 &&
+       g_get_monotonic_time() - state.connectTime >
+           static_cast<gint64>(maxReconnectTimeout) * G_USEC_PER_SEC)
+    {
+        state.attempts = 0;
+    }
+    state.connectTime = 0;
+
+    const guint64 timeoutCeiling =
+        std::min<guint64>(
+            static_cast<guint64>(reconnectTimeout) << std::min(state.attempts, 16u),
+            maxReconnectTimeout) * 1000;
+    const guint timeout =
+        static_cast<guint>(g_random_int_range(0, static_cast<gint32>(timeoutCeiling) + 1));
 
-    Log()->info("Scheduling reconnect in {} seconds...", reconnectTimeout);
+    ++state.attempts;
 
-    GSourcePtr timeoutSourcePtr(g_timeout_source_new_seconds(reconnectTimeout));
+    Log()->info(
+        "Scheduling reconnect of stream #{} in {} ms (attempt {})...",
+        streamIndex, timeout, state.attempts);
+
+    GSourcePtr timeoutSourcePtr(g_timeout_source_new(timeout));
     GSource* timeoutSource = timeoutSourcePtr.get();
     g_source_set_callback(timeoutSource,
         [] (gpointer userData) -> gboolean {
-            static_cast<WsClient*>(userData)->connect();
+            ReconnectData* data = static_cast<ReconnectData*>(userData);
+            data->client->connect(data->streamIndex);
             return false;
-        }, client, nullptr);
+        },
+        new ReconnectData { client, streamIndex },
+        [] (gpointer userData) {
+            delete static_cast<ReconnectData*>(userData);
+        });
     g_source_attach(timeoutSource, g_main_context_get_thread_default());
 }
 
-int main(int /*argc*/, char** /*argv*/)
+static bool RunStreams(
+    const Config* config,
+    const std::vector<unsigned>& streams,
+    GMainLoop* loop) noexcept
 {
-    LibGst libGst;
-
-    Config config {};
-    if(!LoadConfig(&config))
-        return -1;
+    SharedSources sharedSources;
+    for(unsigned streamIndex: streams) {
+        const std::string& sourceName = config->streams[streamIndex].sharedSource;
+        if(sourceName.empty() || sharedSources.count(sourceName))
+            continue;
 
-    InitLwsLogger(config.lwsLogLevel);
-    InitJanusClientLogger(config.logLevel);
+        sharedSources.emplace(
+            sourceName,
+            std::make_unique<SharedSource>(
+                sourceName,
+                config->sharedSources.at(sourceName),
+                config->ice.transportPolicy));
+    }
 
-    GMainLoopPtr loopPtr(g_main_loop_new(nullptr, FALSE));
-    GMainLoop* loop = loopPtr.get();
+    std::vector<ReconnectState> reconnectStates(config->streams.size());
 
     WsClient client(
-        config,
+        *config,
+        streams,
         loop,
         std::bind(
             CreateSession,
-            &config,
+            config,
+            &sharedSources,
+            std::placeholders::_1,
+            std::placeholders::_2),
+        std::bind(
+            ClientConnected,
+            &reconnectStates,
             std::placeholders::_1),
-        std::bind(ClientDisconnected, &config, &client));
+        std::bind(
+            ClientDisconnected,
+            config,
+            &client,
+            &reconnectStates,
+            std::placeholders::_1));
+
+    if(!client.init())
+        return false;
+
+    Log()->info("Starting {} stream(s)...", streams.size());
+    for(unsigned streamIndex: streams)
+        client.connect(streamIndex);
+
+    g_main_loop_run(loop);
+
+    return true;
+}
+
+// streams using the same shared source are always served by the same shard;
+// shardsCount == 0 means separate shard for every stream (or shared source)
+static std::vector<std::vector<unsigned>> AssignStreams(
+    const Config& config,
+    const std::vector<unsigned>& streams,
+    unsigned shardsCount,
+    bool honorStreamWorker)
+{
+    std::vector<std::vector<unsigned>> shardStreams(shardsCount);
+    std::map<std::string, unsigned> sourceShards;
+
+    unsigned nextShard = 0;
+    for(unsigned streamIndex: streams) {
+        const StreamConfig& stream = config.streams[streamIndex];
+
+        unsigned shard;
+        auto it = sourceShards.find(stream.sharedSource);
+        if(!stream.sharedSource.empty() && it != sourceShards.end())
+            shard = it->second;
+        else if(shardsCount == 0) {
+            shard = shardStreams.size();
+            shardStreams.emplace_back();
+        } else if(honorStreamWorker && stream.worker >= 0)
+            shard = static_cast<unsigned>(stream.worker) % shardsCount;
+        else
+            shard = nextShard++ % shardsCount;
+
+        if(!stream.sharedSource.empty())
+            sourceShards.emplace(stream.sharedSource, shard);
+
+        shardStreams[shard].push_back(streamIndex);
+    }
+
+    return shardStreams;
+}
+
+// bumps heartbeat from thread default main context,
+// so it stops if thread is hung
+static GSourcePtr AttachHeartbeat(std::atomic<gint64>* heartbeat)
+{
+    *heartbeat = g_get_monotonic_time();
+
+    GSourcePtr heartbeatSourcePtr(g_timeout_source_new_seconds(HEARTBEAT_INTERVAL));
+    g_source_set_callback(heartbeatSourcePtr.get(),
+        [] (gpointer userData) -> gboolean {
+            *static_cast<std::atomic<gint64>*>(userData) = g_get_monotonic_time();
+            return TRUE;
+        }, heartbeat, nullptr);
+    g_source_attach(heartbeatSourcePtr.get(), g_main_context_get_thread_default());
 
-    if(client.init()) {
-        client.connect();
+    return heartbeatSourcePtr;
+}
+
+static int RunProcess(
+    const Config* config,
+    const std::vector<unsigned>& streams,
+    ProcessStatus* status) noexcept
+{
+    LibGst libGst;
+
+    GMainLoopPtr loopPtr(g_main_loop_new(nullptr, FALSE));
+    GMainLoop* loop = loopPtr.get();
+
+    // main loop runs on main thread in any case
+    std::unique_ptr<CpuGovernor> governorPtr;
+    if(config->cpuGovernor.enabled)
+        governorPtr = std::make_unique<CpuGovernor>(config->cpuGovernor);
+
+    if(config->workers == 0) {
+        GSourcePtr heartbeatSourcePtr;
+        if(status)
+            heartbeatSourcePtr = AttachHeartbeat(&status->heartbeat);
+
+        const bool succeeded = RunStreams(config, streams, loop);
+
+        if(heartbeatSourcePtr)
+            g_source_destroy(heartbeatSourcePtr.get());
+
+        return succeeded ? 0 : -1;
+    }
+
+    const unsigned cpuCount = std::max(1u, std::thread::hardware_concurrency());
+
+    std::atomic<bool> failed(false);
+
+    // every worker bumps it's own heartbeat,
+    // main thread publishes the oldest one
+    struct Heartbeats {
+        ProcessStatus* status;
+        std::deque<std::atomic<gint64>> workers;
+    } heartbeats { status, {} };
+
+    const std::vector<std::vector<unsigned>> workerStreams =
+        AssignStreams(*config, streams, config->workers, true);
+    std::deque<Worker> workers;
+    for(unsigned workerIndex = 0; workerIndex < workerStreams.size(); ++workerIndex) {
+        const std::vector<unsigned>& shardStreams = workerStreams[workerIndex];
+        if(shardStreams.empty())
+            continue;
+
+        const int cpu =
+            config->cpuAffinity ?
+                static_cast<int>(workerIndex % cpuCount) :
+                -1;
+
+        heartbeats.workers.emplace_back(g_get_monotonic_time());
+        std::atomic<gint64>* workerHeartbeat = &heartbeats.workers.back();
+
+        workers.emplace_back(
+            workerIndex,
+            cpu,
+            [config, &shardStreams, &failed, loop, workerHeartbeat] (GMainLoop* workerLoop) noexcept {
+                GSourcePtr heartbeatSourcePtr = AttachHeartbeat(workerHeartbeat);
+
+                if(!RunStreams(config, shardStreams, workerLoop)) {
+                    failed = true;
+                    QuitLoop(loop);
+                }
+
+                g_source_destroy(heartbeatSourcePtr.get());
+            });
+        workers.back().start();
+    }
+
+    GSourcePtr heartbeatSourcePtr;
+    if(status) {
+        status->heartbeat = g_get_monotonic_time();
+
+        heartbeatSourcePtr.reset(g_timeout_source_new_seconds(HEARTBEAT_INTERVAL));
+        g_source_set_callback(heartbeatSourcePtr.get(),
+            [] (gpointer userData) -> gboolean {
+                Heartbeats* heartbeats = static_cast<Heartbeats*>(userData);
+
+                gint64 heartbeat = g_get_monotonic_time();
+                for(const std::atomic<gint64>& workerHeartbeat: heartbeats->workers)
+                    heartbeat = std::min(heartbeat, workerHeartbeat.load());
+
+                heartbeats->status->heartbeat = heartbeat;
+                return TRUE;
+            }, &heartbeats, nullptr);
+        g_source_attach(heartbeatSourcePtr.get(), nullptr);
+    }
+
+    // main thread serves only heartbeats
+    if(!failed)
         g_main_loop_run(loop);
-    } else
+
+    if(heartbeatSourcePtr)
+        g_source_destroy(heartbeatSourcePtr.get());
+
+    return failed ? -1 : 0;
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+    Config config {};
+    if(!LoadConfig(&config))
         return -1;
 
-    return 0;
+    InitLwsLogger(config.lwsLogLevel);
+    InitJanusClientLogger(config.logLevel);
+
+    SetHandshakesLimit(config.maxHandshakes);
+
+    std::vector<unsigned> streams;
+    for(unsigned streamIndex = 0; streamIndex < config.streams.size(); ++streamIndex)
+        streams.push_back(streamIndex);
+
+    if(config.supervisor.enabled) {
+        // GStreamer should not be initialized before fork
+        Supervisor supervisor(
+            config.supervisor,
+            AssignStreams(config, streams, config.supervisor.processes, false),
+            std::bind(
+                RunProcess,
+                &config,
+                std::placeholders::_2,
+                std::placeholders::_3));
+
+        return supervisor.run();
+    }
+
+    return RunProcess(&config, streams, nullptr);
 }